@@ -45,14 +45,72 @@ This library provides the following functions;
 - qoi_decode  -- decode the raw bytes of a QOI image from memory
 - qoi_write   -- encode and write a QOI file
 - qoi_encode  -- encode an rgba buffer into a QOI image in memory
+- qoi_encode64, qoi_decode64, qoi_write64, qoi_read64
+              -- variants using size_t sizes, for images beyond 2GB
+- qoi_encode_into, qoi_decode_into
+              -- en-/decode into a caller supplied buffer without allocating;
+                 see also qoi_max_encoded_size and qoi_read_header
+- qoi_encode_rect, qoi_decode_rect
+              -- en-/decode a rectangle of a larger, possibly bottom-up surface
+- qoi_encode_format, qoi_format_size
+              -- encode from BGRA, BGRX, RGBX or grayscale pixels, and decode
+                 into BGRA, ARGB, premultiplied alpha or RGB565 by passing a
+                 QOI_FORMAT_* to qoi_decode_into or qoi_decode_rect
+- qoi_encode_parallel
+              -- encode on multiple threads, producing the same output as
+                 qoi_encode64
+- qoi_encode_seekable, qoi_decode_parallel
+              -- encode with a seek index that allows decoding on multiple
+                 threads
+- qoi_decode_region
+              -- decode only a window of an image
+- qoi_probe, qoi_validate
+              -- check that a QOI image is complete without decoding it
+- qoi_stats_collect
+              -- count the ops of a QOI image, with QOI_STATS defined
+- qoi_encode_batch, qoi_decode_batch
+              -- en-/decode many images on multiple threads into one buffer
+- qoi_ctx     -- en-/decode with custom allocators, reusing buffers between
+                 calls (qoi_ctx_init, _encode, _decode, _release, and a
+                 qoi_ctx_* variant of every other allocating function)
+- qoi_encoder -- encode an image incrementally, e.g. row by row, with constant
+                 memory usage (qoi_encoder_init, _push, _finish)
+- qoi_decoder -- decode an image from pieces of data as they arrive, row by row
+                 (qoi_decoder_init, _set_output, _push)
+- qoi_seq_encoder, qoi_seq
+              -- record and play back sequences of frames, storing only the
+                 stripes that changed from the previous frame
+- qoi_lz_pack, qoi_lz_unpack, qoi_lz_encode, qoi_lz_decode
+              -- shrink QOI images further with an optional, fast LZ stage
+- qoi_encode_tiled, qoi_tiled, qoi_read_tiled
+              -- store a large image as independent tiles and decode only the
+                 tiles overlapping a rectangle, on multiple threads
 
 See the function declaration below for the signature and more information.
 
 If you don't want/need the qoi_read and qoi_write functions, you can define
 QOI_NO_STDIO before including this library.
 
+On x86, the encoder and decoder use SSE2 and, if the CPU supports them, AVX2 or
+AVX-512. Define QOI_NO_SIMD to build without these.
+
+The parallel functions use pthreads (link with -pthread) or the Windows API.
+Define QOI_NO_THREADS to build without threads; these functions then do all
+work on the calling thread.
+
+Define QOI_STATS to compile qoi_stats_collect(), which reports the op mix of an
+image. Nothing else changes; without QOI_STATS it is left out entirely.
+
+On POSIX systems, qoi_read and qoi_write map the file into memory instead of
+copying it through an intermediate buffer. Define QOI_NO_MMAP to use stdio
+only. Writing through a mapping needs the Linux fallocate(), which is only
+declared with _GNU_SOURCE; include this file before any system header or
+define _GNU_SOURCE, otherwise qoi_write falls back to stdio. It also falls back
+to stdio on file systems that can't reserve space with fallocate().
+
 This library uses malloc() and free(). To supply your own malloc implementation
-you can define QOI_MALLOC and QOI_FREE before including this library.
+you can define QOI_MALLOC and QOI_FREE before including this library. For
+allocators that need a context, use a qoi_ctx.
 
 This library uses memset() to zero-initialize the index. To supply your own
 implementation you can define QOI_ZEROARR before including this library.
@@ -214,6 +272,8 @@ Header - Public functions */
 #ifndef QOI_H
 #define QOI_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -240,6 +300,14 @@ typedef struct {
 	unsigned char colorspace;
 } qoi_desc;
 
+/* A single pixel as used by the index and the streaming en-/decoder state. The
+v member is only ever compared for equality; its byte order does not matter. */
+
+typedef union {
+	struct { unsigned char r, g, b, a; } rgba;
+	unsigned int v;
+} qoi_rgba_t;
+
 #ifndef QOI_NO_STDIO
 
 /* Encode raw RGB or RGBA pixels into a QOI image and write it to the file
@@ -264,6 +332,19 @@ The returned pixel data should be free()d after use. */
 
 void *qoi_read(const char *filename, qoi_desc *desc, int channels);
 
+
+/* Like qoi_write(), but not limited to QOI_PIXELS_MAX and returning the number
+of bytes written as a size_t. */
+
+size_t qoi_write64(const char *filename, const void *data, const qoi_desc *desc);
+
+
+/* Like qoi_read(), but not limited to QOI_PIXELS_MAX. It reads back any image
+written by qoi_write64(). A forged header still can not cause a huge
+allocation, as the header is checked against the size of the file. */
+
+void *qoi_read64(const char *filename, qoi_desc *desc, int channels);
+
 #endif /* QOI_NO_STDIO */
 
 
@@ -289,6 +370,658 @@ The returned pixel data should be free()d after use. */
 void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels);
 
 
+/* Variants of qoi_encode() and qoi_decode() that use size_t for all sizes.
+
+qoi_encode(), qoi_decode(), qoi_read() and qoi_write() refuse images with more
+than QOI_PIXELS_MAX pixels, as they report sizes as an int or must guard
+against huge allocations for forged headers. qoi_encode64() and qoi_decode64()
+are only limited by the address space; all size computations are checked for
+overflow.
+
+All decoders that allocate the pixels, including qoi_decode64(), refuse images
+with more pixels than their data could cover, i.e. more than 62 pixels per
+byte of chunks, before allocating anything. */
+
+void *qoi_encode64(const void *data, const qoi_desc *desc, size_t *out_len);
+void *qoi_decode64(const void *data, size_t size, qoi_desc *desc, int channels);
+
+
+/* Encode on nthreads threads, including the calling thread. The output is
+identical to that of qoi_encode64(), i.e. a plain QOI image. The image is split
+into stripes that are encoded independently and joined afterwards; images too
+small to be worth splitting are encoded on the calling thread alone.
+
+Threads are created with pthreads or the Windows API. Define QOI_NO_THREADS to
+build without them, in which case all work is done on the calling thread. */
+
+void *qoi_encode_parallel(const void *data, const qoi_desc *desc, int nthreads, size_t *out_len);
+
+
+/* Seek index for parallel decoding
+
+qoi_encode_seekable() works like qoi_encode_parallel() but appends a seek index
+after the end marker. The seek index records the state of the decoder every
+rows_per_entry rows, which must be at least 1. The image remains a valid QOI
+image for any decoder, as decoders stop reading after the last pixel.
+qoi_seek_index_size() returns the number of bytes the seek index takes.
+
+qoi_decode_parallel() works like qoi_decode64() but uses the seek index, if
+present, to decode stripes of rows_per_entry rows on nthreads threads. Without
+a seek index, the image is decoded on the calling thread. Each stripe is checked
+to end in the state recorded for the next one; if the seek index does not match
+the image, the image is decoded again on the calling thread, ignoring it.
+
+The entries of the seek index are covered by a checksum in its footer. A seek
+index with a wrong checksum is ignored by all functions, as if there was
+none. */
+
+size_t qoi_seek_index_size(const qoi_desc *desc, unsigned int rows_per_entry);
+void *qoi_encode_seekable(
+	const void *data, const qoi_desc *desc, unsigned int rows_per_entry,
+	int nthreads, size_t *out_len
+);
+void *qoi_decode_parallel(const void *data, size_t size, qoi_desc *desc, int channels, int nthreads);
+
+
+/* Decode only the w * h pixels at x, y of the image into pixels, with rows
+stride bytes apart. channels has the same meaning as for qoi_decode().
+
+The rows above the region and the pixels left and right of it are decoded
+without being written; decoding stops after the last row of the region. If
+the image has a seek index, decoding starts at the closest entry above the
+region instead of the start of the image.
+
+The entry is trusted without being checked against the image; only damage
+that breaks the checksum of the seek index is detected, in which case it is
+ignored. A seek index that was written for different image data, or forged
+along with its checksum, gives wrong pixels. Check untrusted images with
+qoi_validate() first, which compares every entry with the image.
+
+The function returns 1 on success or 0 if the data is invalid or the region
+does not lie within the image. */
+
+int qoi_decode_region(
+	const void *data, size_t size, qoi_desc *desc,
+	unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+	void *pixels, ptrdiff_t stride, int channels
+);
+
+
+/* Validate a QOI image without decoding it
+
+qoi_probe() reads the header into info->desc and checks that the data ends
+with the end marker, or with the end marker followed by a seek index. It sets
+info->size to the number of bytes up to and including the end marker and
+info->seek_rows to the rows per seek index entry, or 0 if there is none.
+
+qoi_validate() does the same and then walks all chunks without decoding any
+pixels. It checks that the chunks cover exactly width * height pixels, that
+no chunk extends into the end marker and that the end marker follows the last
+chunk directly. Only the structure of the stream is checked; any pixel
+values are valid. If the image has a seek index, the chunks are also decoded,
+without writing any pixels, to check that every entry holds the state of the
+decoder at its row.
+
+Both functions return 1 if the data is valid or 0 otherwise. */
+
+typedef struct {
+	qoi_desc desc;
+	size_t size;
+	unsigned int seek_rows;
+} qoi_info;
+
+int qoi_probe(const void *data, size_t size, qoi_info *info);
+int qoi_validate(const void *data, size_t size, qoi_info *info);
+
+
+#ifdef QOI_STATS
+
+/* Op statistics, only with QOI_STATS defined
+
+qoi_stats_collect() validates a QOI image like qoi_validate() and then walks
+its ops, adding to the counts in stats. Zero stats before the first call;
+collecting several images into the same stats gives their totals. All en- and
+decoders in this library produce and accept the same ops, so the counts
+describe the work of either.
+
+ops[] and bytes[] are indexed by QOI_STATS_INDEX ... _RGBA. runs[k] counts the
+runs of 2^k to 2^(k+1) - 1 pixels, with consecutive QOI_OP_RUNs taken as one
+run; the last bucket also holds all longer runs.
+
+Each pixel that is not part of a run is looked up in the index. On a miss, the
+pixel is stored in its index slot, evicting the pixel the slot held. A miss is
+counted as a hash collision if the pixel is the last one that was evicted from
+its slot, i.e. it would have been a hit if a different pixel with the same hash
+had not taken its place. Misses of pixels that were not in the index before
+are not collisions.
+
+The function returns 1 on success or 0 if the data is invalid. */
+
+#define QOI_STATS_INDEX 0
+#define QOI_STATS_DIFF  1
+#define QOI_STATS_LUMA  2
+#define QOI_STATS_RUN   3
+#define QOI_STATS_RGB   4
+#define QOI_STATS_RGBA  5
+#define QOI_STATS_OPS   6
+
+#define QOI_STATS_RUN_BUCKETS 16
+
+typedef struct {
+	unsigned long long images;
+	unsigned long long pixels;
+	unsigned long long ops[QOI_STATS_OPS];
+	unsigned long long bytes[QOI_STATS_OPS];
+	unsigned long long runs[QOI_STATS_RUN_BUCKETS];
+	unsigned long long index_lookups;
+	unsigned long long index_hits;
+	unsigned long long hash_collisions;
+} qoi_stats;
+
+int qoi_stats_collect(const void *data, size_t size, qoi_stats *stats);
+
+#endif /* QOI_STATS */
+
+
+/* Batch en-/decoding of many images
+
+qoi_encode_batch() and qoi_decode_batch() process count images on nthreads
+threads. The output of all images goes into a single buffer, the arena, which
+is returned and should be free()d after use. Its size is stored in arena_size.
+The functions return NULL if the arena could not be allocated.
+
+For qoi_encode_batch(), set data to the pixels and desc to their description.
+For qoi_decode_batch(), set data and size to the encoded image and channels as
+for qoi_decode(); desc is filled from the header.
+
+For each image, offset and len receive the position and size of its output
+within the arena. len is 0 if the image could not be en-/decoded. The encoded
+images are not necessarily adjacent in the arena. */
+
+typedef struct {
+	const void *data;
+	size_t size;
+	qoi_desc desc;
+	int channels;
+	size_t offset;
+	size_t len;
+} qoi_batch_item;
+
+void *qoi_encode_batch(qoi_batch_item *items, size_t count, int nthreads, size_t *arena_size);
+void *qoi_decode_batch(qoi_batch_item *items, size_t count, int nthreads, size_t *arena_size);
+
+
+/* Reusable codec context
+
+A qoi_ctx keeps the output buffer, and the bookkeeping of the multi-threaded
+encoder, from one call to the next. En- or decoding a sequence of images of the
+same size thus allocates memory only for the first image.
+
+qoi_ctx_init() sets up the context with allocator callbacks and a user pointer
+that is passed to them. alloc must return size bytes, preferably aligned to
+align bytes, or NULL. free receives the pointer and the size it was allocated
+with. If alloc or free is NULL, QOI_MALLOC and QOI_FREE are used for both.
+
+qoi_ctx_encode() and qoi_ctx_decode() work like qoi_encode_parallel() and
+qoi_decode_parallel(), but return a pointer into the buffer of the context. It
+remains valid until the next call with the same context or qoi_ctx_release(),
+which frees all buffers. The input of a call must thus not be the output of the
+previous one. A context must not be used by multiple threads at the same time.
+
+Every other function that allocates memory has a qoi_ctx_* variant as well,
+declared here or next to the function itself. All of them return their output
+in the buffer of the context and take any temporary memory from its allocator.
+With a ctx of NULL, they behave exactly like the function without ctx.
+qoi_encode64() is qoi_ctx_encode() with one thread, qoi_decode64() is
+qoi_ctx_decode() with one thread. Only the stdio functions, qoi_read() and
+qoi_write() and their variants, always use QOI_MALLOC. */
+
+#define QOI_CTX_ALIGN 64
+
+typedef void *(*qoi_alloc_fn)(void *user, size_t size, size_t align);
+typedef void (*qoi_free_fn)(void *user, void *ptr, size_t size);
+
+typedef struct {
+	qoi_alloc_fn alloc;
+	qoi_free_fn free;
+	void *user;
+	void *buffer;
+	size_t buffer_size;
+	void *scratch;
+	size_t scratch_size;
+} qoi_ctx;
+
+void qoi_ctx_init(qoi_ctx *ctx, qoi_alloc_fn alloc, qoi_free_fn free, void *user);
+void qoi_ctx_release(qoi_ctx *ctx);
+void *qoi_ctx_encode(qoi_ctx *ctx, const void *data, const qoi_desc *desc, int nthreads, size_t *out_len);
+void *qoi_ctx_decode(qoi_ctx *ctx, const void *data, size_t size, qoi_desc *desc, int channels, int nthreads);
+void *qoi_ctx_encode_seekable(
+	qoi_ctx *ctx, const void *data, const qoi_desc *desc, unsigned int rows_per_entry,
+	int nthreads, size_t *out_len
+);
+void *qoi_ctx_encode_batch(qoi_ctx *ctx, qoi_batch_item *items, size_t count, int nthreads, size_t *arena_size);
+void *qoi_ctx_decode_batch(qoi_ctx *ctx, qoi_batch_item *items, size_t count, int nthreads, size_t *arena_size);
+
+
+/* Pixel formats
+
+qoi_decode_into() and qoi_decode_rect(), below, accept one of these output
+formats in place of the number of channels. The pixels are converted as they
+are stored, without a separate pass over the output.
+
+QOI_FORMAT_RGB, _RGBA    - the same as 3 and 4 channels
+QOI_FORMAT_BGRA, _ARGB   - 4 bytes per pixel in the given byte order
+QOI_FORMAT_RGBA_PREMUL,
+QOI_FORMAT_BGRA_PREMUL   - like RGBA and BGRA, with the color channels
+                           multiplied by alpha / 255, rounded to nearest
+QOI_FORMAT_RGB565        - 2 bytes per pixel, a 16 bit value in native byte
+                           order with 5 bits red in the most significant bits,
+                           6 bits green and 5 bits blue; alpha is dropped
+
+qoi_encode_format() encodes from any of these source formats:
+
+QOI_FORMAT_RGB, _RGBA,
+QOI_FORMAT_BGRA, _ARGB   - as above
+QOI_FORMAT_RGBX, _BGRX   - 4 bytes per pixel, the fourth byte is ignored and
+                           the pixel is opaque
+QOI_FORMAT_GRAY          - 1 byte per pixel, used for r, g and b
+QOI_FORMAT_GRAY16        - 2 bytes per pixel, a 16 bit value in native byte
+                           order, scaled to 8 bits with rounding
+
+The number of channels of the encoded image is given by desc->channels, as
+usual. With 3 channels, the alpha or padding byte of 4 byte formats is
+skipped, so e.g. QOI_FORMAT_BGRX becomes an RGB image. The pixels are
+converted in small blocks that stay in the cache as they are encoded, instead
+of in a separate pass through a temporary image. stride is the distance in
+bytes from one row to the next, or 0 for tightly packed rows; out and
+out_size and the return value are the same as for qoi_encode_into().
+
+qoi_format_size() returns the number of bytes per pixel of a format, or 0 if
+the format is not valid. */
+
+#define QOI_FORMAT_RGB         3
+#define QOI_FORMAT_RGBA        4
+#define QOI_FORMAT_BGRA        5
+#define QOI_FORMAT_ARGB        6
+#define QOI_FORMAT_RGBA_PREMUL 7
+#define QOI_FORMAT_BGRA_PREMUL 8
+#define QOI_FORMAT_RGB565      9
+#define QOI_FORMAT_RGBX        10
+#define QOI_FORMAT_BGRX        11
+#define QOI_FORMAT_GRAY        12
+#define QOI_FORMAT_GRAY16      13
+
+int qoi_format_size(int format);
+size_t qoi_encode_format(
+	const void *pixels, ptrdiff_t stride, int format,
+	const qoi_desc *desc, void *out, size_t out_size
+);
+
+
+/* Encode and decode without allocating any memory
+
+qoi_max_encoded_size() returns the worst case size of the encoded data for the
+image described by desc, or 0 if desc is invalid. A buffer of this size can be
+reused for every image of the same dimensions.
+
+qoi_encode_into() encodes into the caller's out buffer of out_size bytes. It
+returns the size of the encoded data, or 0 if the parameters are invalid or the
+encoded data does not fit. Encoding is fastest if out_size is at least
+qoi_max_encoded_size(desc).
+
+qoi_read_header() only reads the 14 byte header and fills desc. It returns 1 if
+the header is valid or 0 otherwise. Use it to size the pixel buffer for
+qoi_decode_into().
+
+qoi_decode_into() decodes into the caller's pixels buffer, which must hold at
+least width * height * channels bytes. channels has the same meaning as for
+qoi_decode(), or may be one of the QOI_FORMAT_* pixel formats, in which case
+the buffer must hold width * height * qoi_format_size(channels) bytes. It
+returns 1 on success or 0 on failure. */
+
+size_t qoi_max_encoded_size(const qoi_desc *desc);
+size_t qoi_encode_into(const void *data, const qoi_desc *desc, void *out, size_t out_size);
+int qoi_read_header(const void *data, size_t size, qoi_desc *desc);
+int qoi_decode_into(const void *data, size_t size, qoi_desc *desc, void *pixels, size_t pixels_size, int channels);
+
+
+/* Encode from and decode into a rectangle of a larger surface
+
+Both functions address the surface through pixels, pointing to the first byte
+of row 0, and stride, the distance in bytes from one row to the next. stride
+may be negative for bottom-up surfaces, in which case pixels points to the row
+that ends up on top of the image. x and y select the top left corner of the
+rectangle within the surface.
+
+qoi_encode_rect() encodes the desc->width * desc->height rectangle at x, y into
+the caller's out buffer, like qoi_encode_into(). desc->channels is the number
+of channels of the surface.
+
+qoi_decode_rect() decodes into the rectangle at x, y of the caller's surface,
+which must be large enough to hold the image, like qoi_decode_into(). channels
+is the number of channels of the surface, 0 to use the channels from the
+header, or one of the QOI_FORMAT_* pixel formats. Pixels outside of the
+rectangle are not touched.
+
+Both functions return the same values as their _into counterparts. */
+
+size_t qoi_encode_rect(
+	const void *pixels, ptrdiff_t stride, unsigned int x, unsigned int y,
+	const qoi_desc *desc, void *out, size_t out_size
+);
+int qoi_decode_rect(
+	const void *data, size_t size, qoi_desc *desc,
+	void *pixels, ptrdiff_t stride, unsigned int x, unsigned int y, int channels
+);
+
+
+/* Streaming encoder
+
+The streaming encoder keeps the encoder state (index, previous pixel and run)
+in a qoi_encoder struct and accepts the pixel data in spans of any length, e.g.
+one row at a time. Encoded bytes are collected in a small buffer inside the
+struct and handed to the write callback whenever it fills up. Memory usage is
+constant, regardless of the image size, and the output is identical to that of
+qoi_encode().
+
+The write callback receives the user pointer given to qoi_encoder_init() and
+must return non-zero on success. A zero return value aborts the encoding.
+
+	qoi_encoder enc;
+	qoi_encoder_init(&enc, &desc, my_write_fn, my_file);
+	for (y = 0; y < desc.height; y++) {
+		qoi_encoder_push(&enc, rows[y], desc.width);
+	}
+	qoi_encoder_finish(&enc);
+
+qoi_encoder_init() validates the qoi_desc and writes the header.
+qoi_encoder_push() encodes the next count pixels, given as packed RGB or RGBA
+according to desc->channels. qoi_encoder_finish() terminates the last run and
+writes the end marker. It fails if fewer or more than width * height pixels
+have been pushed in total.
+
+All functions return 0 on failure or 1 on success. Once a function has failed,
+all subsequent calls on the same qoi_encoder fail as well. Since the image is
+never held in memory, the streaming encoder is not subject to the size limit of
+qoi_encode(). */
+
+#ifndef QOI_ENCODER_BUFFER_SIZE
+	#define QOI_ENCODER_BUFFER_SIZE 4096
+#endif
+
+typedef int (*qoi_write_fn)(void *user, const void *data, size_t size);
+
+typedef struct {
+	qoi_rgba_t index[64];
+	qoi_rgba_t px_prev;
+	int run;
+	int channels;
+	unsigned long long px_left;
+	qoi_write_fn write;
+	void *user;
+	int error;
+	int len;
+	unsigned char buffer[QOI_ENCODER_BUFFER_SIZE];
+} qoi_encoder;
+
+int qoi_encoder_init(qoi_encoder *enc, const qoi_desc *desc, qoi_write_fn write, void *user);
+int qoi_encoder_push(qoi_encoder *enc, const void *pixels, size_t count);
+int qoi_encoder_finish(qoi_encoder *enc);
+
+
+/* Streaming decoder
+
+The streaming decoder accepts the encoded data in pieces of any size, e.g. as
+they arrive from a socket or pipe. Pieces may end anywhere, even in the middle
+of the header or of a chunk. Pixels are decoded into a caller supplied buffer
+that holds a single row, so memory usage is independent of the image height.
+
+qoi_decoder_init() resets the decoder. channels may be 0, 3 or 4 with the same
+meaning as for qoi_decode().
+
+qoi_decoder_push() consumes bytes from data and sets consumed to the number of
+bytes used. It returns one of the following:
+
+QOI_DECODER_NEED_MORE - all bytes were consumed; push more data
+QOI_DECODER_HEADER    - the header has been read and decoder->desc is filled.
+                        Call qoi_decoder_set_output() before pushing the rest
+QOI_DECODER_ROW       - a row has been completed in the row buffer. Returned
+                        only if no row callback was set
+QOI_DECODER_DONE      - the image and end marker have been read completely.
+                        Any bytes after the end marker are not consumed
+QOI_DECODER_ERROR     - the data is invalid, the row buffer is too small or
+                        the row callback returned 0
+
+Bytes that were not consumed must be pushed again in the next call.
+
+qoi_decoder_set_output() sets the row buffer, which must hold at least
+desc.width * channels bytes. If row_fn is not NULL, it is called with the
+user pointer for every completed row and decoding continues without returning
+to the caller. If it returns 0, decoding is aborted with QOI_DECODER_ERROR. */
+
+#define QOI_DECODER_ERROR    -1
+#define QOI_DECODER_NEED_MORE 0
+#define QOI_DECODER_HEADER    1
+#define QOI_DECODER_ROW       2
+#define QOI_DECODER_DONE      3
+
+typedef int (*qoi_row_fn)(void *user, const void *row, unsigned int y);
+
+typedef struct {
+	qoi_desc desc;
+	qoi_rgba_t index[64];
+	qoi_rgba_t px;
+	int run;
+	int channels;
+	int state;
+	unsigned int x, y;
+	unsigned char *row;
+	size_t row_size;
+	qoi_row_fn row_fn;
+	void *user;
+	int pending_len;
+	unsigned char pending[16];
+} qoi_decoder;
+
+void qoi_decoder_init(qoi_decoder *dec, int channels);
+void qoi_decoder_set_output(qoi_decoder *dec, void *row, size_t row_size, qoi_row_fn row_fn, void *user);
+int qoi_decoder_push(qoi_decoder *dec, const void *data, size_t size, size_t *consumed);
+
+
+/* Frame sequences
+
+A frame sequence stores many frames of the same size, e.g. from a screen
+recorder, where most of each frame is unchanged from the previous one. The
+frame is divided into stripes of stripe_rows rows. Each frame is stored as
+either
+ - a key frame: a standard QOI image of the whole frame,
+ - a repeated frame: identical to the previous frame, taking a single byte, or
+ - a delta frame: a bitmap of the stripes that changed, each followed by a
+   standard QOI image of the stripe. Unchanged stripes are not stored.
+A table with the offset of every frame is appended after the last frame.
+
+qoi_seq_encoder_init() starts a sequence, writing through the write callback
+like the streaming encoder. stripe_rows may be 0 for a default of 16. Every
+key_interval frames a key frame is forced, so that playback can start there;
+with a key_interval of 0 only the first frame is a key frame.
+qoi_ctx_seq_encoder_init() takes the memory of the encoder from the allocator
+of ctx instead, which must remain valid until qoi_seq_encoder_finish().
+qoi_seq_encoder_push() compares a frame, packed RGB or RGBA according to
+desc->channels, with the previous one and writes it. qoi_seq_encoder_finish()
+writes the frame table and frees the memory of the encoder. It must be called
+even if an earlier function failed. All functions return 0 on failure or 1 on
+success; once a function has failed, all subsequent calls fail as well.
+
+qoi_seq_open() reads the header and frame table of a sequence held in memory
+into seq. It returns 1 on success or 0 if the data is invalid. The data must
+remain valid while seq is in use.
+
+qoi_seq_decode_frame() decodes a frame into pixels, which must hold
+width * height * channels bytes. channels has the same meaning as for
+qoi_decode(). Unless the frame is a key frame, pixels must hold the previous
+frame, decoded with the same channels; only the stripes that changed are
+written. qoi_seq_key_frame() returns the last key frame at or before frame;
+to start playback at any frame, decode from there. qoi_seq_decode_frame()
+returns 1 on success or 0 on failure. */
+
+typedef struct {
+	qoi_desc desc;
+	unsigned int stripe_rows;
+	unsigned int key_interval;
+	unsigned int frames;
+	unsigned long long offset;
+	unsigned long long *table;
+	unsigned int table_size;
+	unsigned char *prev;
+	unsigned char *bitmap;
+	unsigned char *buffer;
+	size_t buffer_size;
+	qoi_write_fn write;
+	void *user;
+	qoi_ctx *ctx;
+	int error;
+} qoi_seq_encoder;
+
+typedef struct {
+	const unsigned char *bytes;
+	size_t table;
+	qoi_desc desc;
+	unsigned int stripe_rows;
+	unsigned int frames;
+} qoi_seq;
+
+int qoi_seq_encoder_init(
+	qoi_seq_encoder *enc, const qoi_desc *desc, unsigned int stripe_rows,
+	unsigned int key_interval, qoi_write_fn write, void *user
+);
+int qoi_ctx_seq_encoder_init(
+	qoi_ctx *ctx, qoi_seq_encoder *enc, const qoi_desc *desc, unsigned int stripe_rows,
+	unsigned int key_interval, qoi_write_fn write, void *user
+);
+int qoi_seq_encoder_push(qoi_seq_encoder *enc, const void *pixels);
+int qoi_seq_encoder_finish(qoi_seq_encoder *enc);
+
+int qoi_seq_open(qoi_seq *seq, const void *data, size_t size);
+unsigned int qoi_seq_key_frame(const qoi_seq *seq, unsigned int frame);
+int qoi_seq_decode_frame(const qoi_seq *seq, unsigned int frame, void *pixels, int channels);
+
+
+/* LZ back-end
+
+QOI leaves some redundancy in its output, such as repeated sequences of ops for
+repeated patterns in the image. qoi_lz_pack() removes some of it with a fast
+LZ77 compressor in the style of LZ4. It splits the data into independent
+blocks of block_size bytes, or QOI_LZ_BLOCK_SIZE if block_size is 0, which
+are compressed on nthreads threads. A block that does not get smaller is
+stored as is. qoi_lz_unpack() restores the original data, decompressing the
+blocks on nthreads threads. Both return a pointer to the data, which should be
+free()d after use, and set out_len to its size, or return NULL on failure.
+
+qoi_lz_pack() accepts any data, but is meant for QOI images. qoi_lz_encode()
+combines it with qoi_encode_parallel(). qoi_lz_decode() decompresses nthreads
+blocks at a time and decodes the QOI image as the blocks come in, so that it is
+never held in memory as a whole. Only if nthreads is above 1 and the packed
+image has a seek index, it is unpacked completely and decoded with
+qoi_decode_parallel(), which needs the whole image to start each stripe at its
+seek index entry. Packed data is not a QOI image; it starts with the magic
+bytes "qoiz". The qoi_ctx_* variants return their output in the buffer of ctx,
+see qoi_ctx. */
+
+#ifndef QOI_LZ_BLOCK_SIZE
+	#define QOI_LZ_BLOCK_SIZE (256 * 1024)
+#endif
+
+void *qoi_lz_pack(const void *data, size_t size, size_t block_size, int nthreads, size_t *out_len);
+void *qoi_lz_unpack(const void *data, size_t size, int nthreads, size_t *out_len);
+void *qoi_lz_encode(const void *data, const qoi_desc *desc, int nthreads, size_t *out_len);
+void *qoi_lz_decode(const void *data, size_t size, qoi_desc *desc, int channels, int nthreads);
+void *qoi_ctx_lz_pack(
+	qoi_ctx *ctx, const void *data, size_t size, size_t block_size, int nthreads, size_t *out_len
+);
+void *qoi_ctx_lz_unpack(qoi_ctx *ctx, const void *data, size_t size, int nthreads, size_t *out_len);
+void *qoi_ctx_lz_encode(qoi_ctx *ctx, const void *data, const qoi_desc *desc, int nthreads, size_t *out_len);
+void *qoi_ctx_lz_decode(qoi_ctx *ctx, const void *data, size_t size, qoi_desc *desc, int channels, int nthreads);
+
+
+/* Tiled images
+
+A tiled image splits a large image into tiles of tile_width * tile_height
+pixels, with smaller tiles at the right and bottom edges if the image size is
+not a multiple of the tile size. Every tile is stored as a standard QOI image,
+preceded by a header and a table of the offsets of all tiles. Tiles can thus be
+en- and decoded independently of each other, on multiple threads, and a part
+of the image can be decoded from just the tiles that it overlaps. A tiled image
+is not a QOI image; it starts with the magic bytes "qoit".
+
+qoi_encode_tiled() encodes the image on nthreads threads. tile_width and
+tile_height may be 0 for a default of QOI_TILE_SIZE. It returns the encoded
+data, which should be free()d after use, and sets out_len to its size, or
+returns NULL on failure.
+
+qoi_tiled_open() reads the header and offset table of a tiled image held in
+memory into tiled. It returns 1 on success or 0 if the data is invalid. The data
+must remain valid while tiled is in use.
+
+qoi_tiled_tile() returns a pointer to the QOI image of the tile in column tx and
+row ty and sets size to its size, or returns NULL if there is no such tile.
+
+qoi_tiled_decode_rect() decodes the w * h pixels at x, y of the image into
+pixels, with rows stride bytes apart, on nthreads threads. Only the tiles
+that overlap the rectangle are read. channels has the same meaning as for
+qoi_decode(). It returns 1 on success or 0 if any tile is invalid or the
+rectangle does not lie within the image.
+
+qoi_ctx_encode_tiled() returns its output in the buffer of ctx, see qoi_ctx;
+both qoi_ctx_* variants take any temporary memory from the allocator of ctx.
+
+qoi_read_tiled() works like qoi_tiled_decode_rect() on a tiled image file and
+returns the packed pixels of the rectangle, which should be free()d after use,
+or NULL on failure. desc is filled with the description of the whole image.
+On POSIX systems the file is mapped into memory, so that only the pages of the
+tiles that are needed are read from disk; otherwise just these tiles are read
+with stdio. */
+
+#ifndef QOI_TILE_SIZE
+	#define QOI_TILE_SIZE 256
+#endif
+
+typedef struct {
+	const unsigned char *bytes;
+	size_t size;
+	qoi_desc desc;
+	unsigned int tile_width;
+	unsigned int tile_height;
+	unsigned int tiles_x;
+	unsigned int tiles_y;
+} qoi_tiled;
+
+void *qoi_encode_tiled(
+	const void *data, const qoi_desc *desc, unsigned int tile_width,
+	unsigned int tile_height, int nthreads, size_t *out_len
+);
+int qoi_tiled_open(qoi_tiled *tiled, const void *data, size_t size);
+const void *qoi_tiled_tile(const qoi_tiled *tiled, unsigned int tx, unsigned int ty, size_t *size);
+int qoi_tiled_decode_rect(
+	const qoi_tiled *tiled, unsigned int x, unsigned int y, unsigned int w,
+	unsigned int h, void *pixels, ptrdiff_t stride, int channels, int nthreads
+);
+void *qoi_ctx_encode_tiled(
+	qoi_ctx *ctx, const void *data, const qoi_desc *desc, unsigned int tile_width,
+	unsigned int tile_height, int nthreads, size_t *out_len
+);
+int qoi_ctx_tiled_decode_rect(
+	qoi_ctx *ctx, const qoi_tiled *tiled, unsigned int x, unsigned int y, unsigned int w,
+	unsigned int h, void *pixels, ptrdiff_t stride, int channels, int nthreads
+);
+
+#ifndef QOI_NO_STDIO
+void *qoi_read_tiled(
+	const char *filename, qoi_desc *desc, unsigned int x, unsigned int y,
+	unsigned int w, unsigned int h, int channels, int nthreads
+);
+#endif
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -299,6 +1032,16 @@ void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels);
 Implementation */
 
 #ifdef QOI_IMPLEMENTATION
+
+/* The memory mapped qoi_write() reserves disk space with the Linux
+fallocate(), which glibc and musl only declare for _GNU_SOURCE. Ask for it,
+which only takes effect if this file is included before any system header. */
+#if \
+	defined(__linux__) && !defined(_GNU_SOURCE) && !defined(_POSIX_C_SOURCE) && \
+	!defined(_XOPEN_SOURCE) && !defined(QOI_NO_STDIO) && !defined(QOI_NO_MMAP)
+	#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 
@@ -325,27 +1068,24 @@ Implementation */
 	 ((unsigned int)'i') <<  8 | ((unsigned int)'f'))
 #define QOI_HEADER_SIZE 14
 
-/* 2GB is the max file size that this implementation can safely handle. We guard
-against anything larger than that, assuming the worst case with 5 bytes per
-pixel, rounded down to a nice clean value. 400 million pixels ought to be
-enough for anybody. */
+/* 2GB is the max file size that can be reported through the int out_len of
+qoi_encode() and the return value of qoi_write(). These guard against anything
+larger than that, assuming the worst case with 5 bytes per pixel, rounded down
+to a nice clean value. qoi_decode() and qoi_read() keep the same limit. Use
+qoi_encode64(), qoi_decode64(), qoi_write64() and qoi_read64() for larger
+images. */
 #define QOI_PIXELS_MAX ((unsigned int)400000000)
 
-typedef union {
-	struct { unsigned char r, g, b, a; } rgba;
-	unsigned int v;
-} qoi_rgba_t;
-
 static const unsigned char qoi_padding[8] = {0,0,0,0,0,0,0,1};
 
-static void qoi_write_32(unsigned char *bytes, int *p, unsigned int v) {
+static void qoi_write_32(unsigned char *bytes, size_t *p, unsigned int v) {
 	bytes[(*p)++] = (0xff000000 & v) >> 24;
 	bytes[(*p)++] = (0x00ff0000 & v) >> 16;
 	bytes[(*p)++] = (0x0000ff00 & v) >> 8;
 	bytes[(*p)++] = (0x000000ff & v);
 }
 
-static unsigned int qoi_read_32(const unsigned char *bytes, int *p) {
+static unsigned int qoi_read_32(const unsigned char *bytes, size_t *p) {
 	unsigned int a = bytes[(*p)++];
 	unsigned int b = bytes[(*p)++];
 	unsigned int c = bytes[(*p)++];
@@ -353,56 +1093,46 @@ static unsigned int qoi_read_32(const unsigned char *bytes, int *p) {
 	return a << 24 | b << 16 | c << 8 | d;
 }
 
-void *qoi_encode(const void *data, const qoi_desc *desc, int *out_len) {
-	int i, max_size, p, run;
-	int px_len, px_end, px_pos, channels;
-	unsigned char *bytes;
-	const unsigned char *pixels;
-	qoi_rgba_t index[64];
-	qoi_rgba_t px, px_prev;
-
-	if (
-		data == NULL || out_len == NULL || desc == NULL ||
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		desc->height >= QOI_PIXELS_MAX / desc->width
-	) {
-		return NULL;
-	}
-
-	max_size =
-		desc->width * desc->height * (desc->channels + 1) +
-		QOI_HEADER_SIZE + sizeof(qoi_padding);
-
-	p = 0;
-	bytes = (unsigned char *) QOI_MALLOC(max_size);
-	if (!bytes) {
-		return NULL;
-	}
-
-	qoi_write_32(bytes, &p, QOI_MAGIC);
-	qoi_write_32(bytes, &p, desc->width);
-	qoi_write_32(bytes, &p, desc->height);
-	bytes[p++] = desc->channels;
-	bytes[p++] = desc->colorspace;
-
+#if defined(__GNUC__) || defined(__clang__)
+	#define QOI_FORCE_INLINE static __inline__ __attribute__((always_inline))
+#elif defined(_MSC_VER)
+	#define QOI_FORCE_INLINE static __forceinline
+#else
+	#define QOI_FORCE_INLINE static
+#endif
 
-	pixels = (const unsigned char *)data;
+/* QOI_COLOR_HASH() % 64 with a single multiplication. The bytes r, g, b, a of
+the pixel are spread into the 16 bit lanes r, b, g, a of a 64 bit word. The
+multiplication then sums up r * 3 + g * 5 + b * 7 + a * 11 in the top lane,
+while the lower lanes are too small to carry into it. */
+#if \
+	(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || \
+	defined(_MSC_VER)
+	#define QOI_HASH(C) ((unsigned int)(( \
+		((unsigned long long)((C).v & 0xff00ff00u) << 24 | ((C).v & 0x00ff00ffu)) * \
+		0x000300070005000Bull) >> 48) & 63)
+#else
+	#define QOI_HASH(C) (QOI_COLOR_HASH(C) % 64)
+#endif
 
-	QOI_ZEROARR(index);
+/* Encode px_len bytes of RGB or RGBA pixels, continuing from the state in
+index, px_prev and run. A run that is still open at the end of the span is left
+in run and must be terminated with qoi_encode_end_run() once the image is
+complete. The caller has to make sure that bytes can hold at least
+px_len / channels * (channels + 1) + 1 more bytes. */
+static size_t qoi_encode_span(
+	qoi_rgba_t *index, qoi_rgba_t *px_prev_p, int *run_p,
+	const unsigned char *pixels, size_t px_len, int channels,
+	unsigned char *bytes, size_t p
+) {
+	size_t px_pos;
+	int run;
+	qoi_rgba_t px, px_prev;
 
-	run = 0;
-	px_prev.rgba.r = 0;
-	px_prev.rgba.g = 0;
-	px_prev.rgba.b = 0;
-	px_prev.rgba.a = 255;
+	run = *run_p;
+	px_prev = *px_prev_p;
 	px = px_prev;
 
-	px_len = desc->width * desc->height * desc->channels;
-	px_end = px_len - desc->channels;
-	channels = desc->channels;
-
 	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
 		px.rgba.r = pixels[px_pos + 0];
 		px.rgba.g = pixels[px_pos + 1];
@@ -414,7 +1144,7 @@ void *qoi_encode(const void *data, const qoi_desc *desc, int *out_len) {
 
 		if (px.v == px_prev.v) {
 			run++;
-			if (run == 62 || px_pos == px_end) {
+			if (run == 62) {
 				bytes[p++] = QOI_OP_RUN | (run - 1);
 				run = 0;
 			}
@@ -477,159 +1207,4930 @@ void *qoi_encode(const void *data, const qoi_desc *desc, int *out_len) {
 		px_prev = px;
 	}
 
-	for (i = 0; i < (int)sizeof(qoi_padding); i++) {
-		bytes[p++] = qoi_padding[i];
-	}
-
-	*out_len = p;
-	return bytes;
+	*run_p = run;
+	*px_prev_p = px_prev;
+	return p;
 }
 
-void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels) {
-	const unsigned char *bytes;
-	unsigned int header_magic;
-	unsigned char *pixels;
-	qoi_rgba_t index[64];
-	qoi_rgba_t px;
-	int px_len, chunks_len, px_pos;
-	int p = 0, run = 0;
-
-	if (
-		data == NULL || desc == NULL ||
-		(channels != 0 && channels != 3 && channels != 4) ||
-		size < QOI_HEADER_SIZE + (int)sizeof(qoi_padding)
-	) {
-		return NULL;
+static size_t qoi_encode_end_run(int *run_p, unsigned char *bytes, size_t p) {
+	if (*run_p > 0) {
+		bytes[p++] = QOI_OP_RUN | (*run_p - 1);
+		*run_p = 0;
 	}
+	return p;
+}
 
-	bytes = (const unsigned char *)data;
+/* The encode kernel below is a faster equivalent of qoi_encode_span() that
+produces identical output. It
+ - has separate code paths for 3 and 4 channels, through qoi_encode_bulk()
+   being inlined with a constant channels argument
+ - loads each pixel as a single 32 bit word and compares whole words
+ - measures runs in bulk with SSE2 or AVX2 compares where available, and emits
+   all QOI_OP_RUN bytes of a run in one go
+ - uses QOI_HASH() instead of QOI_COLOR_HASH() % 64
+ - on x86, classifies blocks of pixels with vector instructions before the
+   ops are written, see qoi_encode_blocks()
+
+The SSE2, AVX2 or AVX-512 variant of the kernel is picked at runtime, depending
+on what the CPU supports. Define QOI_NO_SIMD to build without them.
+
+Loading 4 bytes for a 3 channel pixel reads one byte past the pixel, so the
+bulk loops stop one pixel before the end of the input. That last pixel is
+handled by qoi_encode_span(). QOI_OP_RGB is written with a 4 byte store as
+well, which stays within the room reserved for the pixels that follow. */
+
+#if !defined(QOI_NO_SIMD) && ( \
+	defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define QOI_SIMD_SSE2
+	#include <emmintrin.h>
+
+	/* AVX2 and AVX-512 functions are compiled for their target regardless of
+	the compiler flags, and only called if the CPU supports them */
+	#if defined(__GNUC__) || defined(__clang__)
+		#define QOI_SIMD_AVX2
+		#define QOI_SIMD_AVX512
+		#define QOI_TARGET_AVX2 __attribute__((target("avx2")))
+		#define QOI_TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+		#include <immintrin.h>
+	#elif defined(_MSC_VER)
+		#define QOI_SIMD_AVX2
+		#define QOI_SIMD_AVX512
+		#define QOI_TARGET_AVX2
+		#define QOI_TARGET_AVX512
+		#include <immintrin.h>
+		#include <intrin.h>
+	#endif
+#endif
 
-	header_magic = qoi_read_32(bytes, &p);
-	desc->width = qoi_read_32(bytes, &p);
-	desc->height = qoi_read_32(bytes, &p);
-	desc->channels = bytes[p++];
-	desc->colorspace = bytes[p++];
+#define QOI_ISA_SCALAR 0
+#define QOI_ISA_SSE2   1
+#define QOI_ISA_AVX2   2
+#define QOI_ISA_AVX512 3
 
-	if (
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 ||
-		header_magic != QOI_MAGIC ||
-		desc->height >= QOI_PIXELS_MAX / desc->width
-	) {
-		return NULL;
-	}
+#if defined(QOI_SIMD_SSE2)
 
-	if (channels == 0) {
-		channels = desc->channels;
-	}
+static int qoi_cpu_isa_cached = -1;
 
-	px_len = desc->width * desc->height * channels;
-	pixels = (unsigned char *) QOI_MALLOC(px_len);
-	if (!pixels) {
-		return NULL;
+static int qoi_cpu_isa(void) {
+	if (qoi_cpu_isa_cached < 0) {
+		int isa = QOI_ISA_SSE2;
+	#if defined(QOI_SIMD_AVX2) && (defined(__GNUC__) || defined(__clang__))
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			isa = QOI_ISA_AVX2;
+		}
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+			isa = QOI_ISA_AVX512;
+		}
+	#elif defined(QOI_SIMD_AVX2)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] >= 7) {
+			__cpuid(info, 1);
+			/* OSXSAVE and the OS saving the YMM registers, and for AVX-512
+			the ZMM and mask registers */
+			if ((info[2] & (1 << 27)) && (_xgetbv(0) & 0x06) == 0x06) {
+				__cpuidex(info, 7, 0);
+				if (info[1] & (1 << 5)) {
+					isa = QOI_ISA_AVX2;
+				}
+				if (
+					(info[1] & (1 << 16)) && (info[1] & (1 << 30)) &&
+					(_xgetbv(0) & 0xe6) == 0xe6
+				) {
+					isa = QOI_ISA_AVX512;
+				}
+			}
+		}
+	#endif
+		qoi_cpu_isa_cached = isa;
 	}
+	return qoi_cpu_isa_cached;
+}
 
-	QOI_ZEROARR(index);
-	px.rgba.r = 0;
-	px.rgba.g = 0;
-	px.rgba.b = 0;
-	px.rgba.a = 255;
+/* Number of trailing zero bits; v must not be 0 */
+static int qoi_ctz(unsigned int v) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctz(v);
+#else
+	int n = 0;
+	for (; !(v & 1); v >>= 1) {
+		n++;
+	}
+	return n;
+#endif
+}
 
-	chunks_len = size - (int)sizeof(qoi_padding);
-	for (px_pos = 0; px_pos < px_len; px_pos += channels) {
-		if (run > 0) {
-			run--;
-		}
-		else if (p < chunks_len) {
-			int b1 = bytes[p++];
+/* Return the number of leading bytes of src[0..len) that are equal to the 96
+byte pattern, repeated. Only whole blocks of 96 bytes are compared; the rest
+is left to the caller. */
+static size_t qoi_run_scan_sse2(const unsigned char *src, size_t len, const unsigned char *pattern) {
+	__m128i pat[6];
+	size_t pos;
+	int i;
 
-			if (b1 == QOI_OP_RGB) {
-				px.rgba.r = bytes[p++];
-				px.rgba.g = bytes[p++];
-				px.rgba.b = bytes[p++];
-			}
-			else if (b1 == QOI_OP_RGBA) {
-				px.rgba.r = bytes[p++];
-				px.rgba.g = bytes[p++];
-				px.rgba.b = bytes[p++];
-				px.rgba.a = bytes[p++];
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
-				px = index[b1];
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
-				px.rgba.r += ((b1 >> 4) & 0x03) - 2;
-				px.rgba.g += ((b1 >> 2) & 0x03) - 2;
-				px.rgba.b += ( b1       & 0x03) - 2;
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
-				int b2 = bytes[p++];
-				int vg = (b1 & 0x3f) - 32;
-				px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
-				px.rgba.g += vg;
-				px.rgba.b += vg - 8 +  (b2       & 0x0f);
-			}
-			else if ((b1 & QOI_MASK_2) == QOI_OP_RUN) {
-				run = (b1 & 0x3f);
+	for (i = 0; i < 6; i++) {
+		pat[i] = _mm_loadu_si128((const __m128i *)(pattern + i * 16));
+	}
+	for (pos = 0; len - pos >= 96; pos += 96) {
+		for (i = 0; i < 6; i++) {
+			__m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(src + pos + i * 16)), pat[i]);
+			unsigned int m = (unsigned int)_mm_movemask_epi8(c) ^ 0xffff;
+			if (m != 0) {
+				return pos + i * 16 + qoi_ctz(m);
 			}
-
-			index[QOI_COLOR_HASH(px) % 64] = px;
 		}
+	}
+	return pos;
+}
 
-		pixels[px_pos + 0] = px.rgba.r;
-		pixels[px_pos + 1] = px.rgba.g;
-		pixels[px_pos + 2] = px.rgba.b;
-		
-		if (channels == 4) {
-			pixels[px_pos + 3] = px.rgba.a;
+#if defined(QOI_SIMD_AVX2)
+static QOI_TARGET_AVX2 size_t qoi_run_scan_avx2(const unsigned char *src, size_t len, const unsigned char *pattern) {
+	__m256i pat0 = _mm256_loadu_si256((const __m256i *)(pattern +  0));
+	__m256i pat1 = _mm256_loadu_si256((const __m256i *)(pattern + 32));
+	__m256i pat2 = _mm256_loadu_si256((const __m256i *)(pattern + 64));
+	size_t pos;
+
+	for (pos = 0; len - pos >= 96; pos += 96) {
+		__m256i c0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(src + pos +  0)), pat0);
+		__m256i c1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(src + pos + 32)), pat1);
+		__m256i c2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(src + pos + 64)), pat2);
+		unsigned int m;
+		if ((m = ~(unsigned int)_mm256_movemask_epi8(c0)) != 0) {
+			return pos + qoi_ctz(m);
+		}
+		if ((m = ~(unsigned int)_mm256_movemask_epi8(c1)) != 0) {
+			return pos + 32 + qoi_ctz(m);
+		}
+		if ((m = ~(unsigned int)_mm256_movemask_epi8(c2)) != 0) {
+			return pos + 64 + qoi_ctz(m);
 		}
 	}
-
-	return pixels;
+	return pos;
 }
+#endif
 
-#ifndef QOI_NO_STDIO
-#include <stdio.h>
+#endif /* QOI_SIMD_SSE2 */
+
+/* Return the number of whole pixels at the start of pixels[0..len) that are
+equal to px. Most runs are short, so the first few pixels are compared one by
+one before setting up the vector compares. These work on a pattern of px
+repeated over 96 bytes, which holds a whole number of both 3 and 4 channel
+pixels. */
+QOI_FORCE_INLINE size_t qoi_encode_run_length(
+	const unsigned char *pixels, size_t len, qoi_rgba_t px, int channels, int isa
+) {
+	size_t pos = 0;
+	size_t scalar_len = len < 8 * (size_t)channels ? len : 8 * (size_t)channels;
+
+	for (; pos + channels <= scalar_len; pos += channels) {
+		if (memcmp(pixels + pos, &px, channels) != 0) {
+			return pos / channels;
+		}
+	}
 
-int qoi_write(const char *filename, const void *data, const qoi_desc *desc) {
-	FILE *f = fopen(filename, "wb");
-	int size;
-	void *encoded;
+#if defined(QOI_SIMD_SSE2)
+	if (isa != QOI_ISA_SCALAR && len - pos >= 96) {
+		unsigned char pattern[96 + 4];
+		int i;
 
-	if (!f) {
-		return 0;
+		for (i = 0; i < 96; i += channels) {
+			memcpy(pattern + i, &px, 4);
+		}
+	#if defined(QOI_SIMD_AVX2)
+		if (isa >= QOI_ISA_AVX2) {
+			pos += qoi_run_scan_avx2(pixels + pos, len - pos, pattern);
+		}
+		else
+	#endif
+		{
+			pos += qoi_run_scan_sse2(pixels + pos, len - pos, pattern);
+		}
+		pos -= pos % channels;
 	}
+#else
+	(void)isa;
+#endif
 
-	encoded = qoi_encode(data, desc, &size);
-	if (!encoded) {
-		fclose(f);
-		return 0;
+	for (; pos + channels <= len; pos += channels) {
+		if (memcmp(pixels + pos, &px, channels) != 0) {
+			break;
+		}
 	}
-
-	fwrite(encoded, 1, size, f);
-	fclose(f);
-
-	QOI_FREE(encoded);
-	return size;
+	return pos / channels;
 }
 
-void *qoi_read(const char *filename, qoi_desc *desc, int channels) {
-	FILE *f = fopen(filename, "rb");
-	int size, bytes_read;
-	void *pixels, *data;
+QOI_FORCE_INLINE size_t qoi_encode_bulk(
+	qoi_rgba_t *index, qoi_rgba_t *px_prev_p, int *run_p,
+	const unsigned char *pixels, size_t *px_pos_p, size_t px_len, int channels, int isa,
+	unsigned char *bytes, size_t p
+) {
+	static const qoi_rgba_t rgb_mask = {{0xff, 0xff, 0xff, 0x00}};
+	size_t px_pos = *px_pos_p;
+	size_t px_bulk = channels == 4 ? px_len : (px_len >= 3 ? px_len - 3 : 0);
+	qoi_rgba_t px, px_prev = *px_prev_p;
+	int run = *run_p;
+
+	while (px_pos < px_bulk) {
+		int index_pos;
+
+		memcpy(&px, pixels + px_pos, 4);
+		if (channels == 3) {
+			px.v = (px.v & rgb_mask.v) | (px_prev.v & ~rgb_mask.v);
+		}
 
-	if (!f) {
+		if (px.v == px_prev.v) {
+			size_t n = qoi_encode_run_length(pixels + px_pos, px_len - px_pos, px, channels, isa);
+			size_t total = (size_t)run + n;
+			memset(bytes + p, QOI_OP_RUN | (62 - 1), total / 62);
+			p += total / 62;
+			run = (int)(total % 62);
+			px_pos += n * channels;
+			continue;
+		}
+
+		if (run > 0) {
+			bytes[p++] = QOI_OP_RUN | (run - 1);
+			run = 0;
+		}
+
+		index_pos = QOI_HASH(px);
+
+		if (index[index_pos].v == px.v) {
+			bytes[p++] = QOI_OP_INDEX | index_pos;
+		}
+		else {
+			index[index_pos] = px;
+
+			if (px.rgba.a == px_prev.rgba.a) {
+				signed char vr = px.rgba.r - px_prev.rgba.r;
+				signed char vg = px.rgba.g - px_prev.rgba.g;
+				signed char vb = px.rgba.b - px_prev.rgba.b;
+
+				signed char vg_r = vr - vg;
+				signed char vg_b = vb - vg;
+
+				if (
+					(unsigned char)(vr + 2) < 4 &&
+					(unsigned char)(vg + 2) < 4 &&
+					(unsigned char)(vb + 2) < 4
+				) {
+					bytes[p++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+				}
+				else if (
+					(unsigned char)(vg_r + 8) < 16 &&
+					(unsigned char)(vg + 32) < 64 &&
+					(unsigned char)(vg_b + 8) < 16
+				) {
+					bytes[p++] = QOI_OP_LUMA     | (vg   + 32);
+					bytes[p++] = (vg_r + 8) << 4 | (vg_b +  8);
+				}
+				else {
+					bytes[p++] = QOI_OP_RGB;
+					memcpy(bytes + p, &px, 4);
+					p += 3;
+				}
+			}
+			else {
+				bytes[p++] = QOI_OP_RGBA;
+				memcpy(bytes + p, &px, 4);
+				p += 4;
+			}
+		}
+		px_prev = px;
+		px_pos += channels;
+	}
+
+	*px_prev_p = px_prev;
+	*run_p = run;
+	*px_pos_p = px_pos;
+	return p;
+}
+
+#if defined(QOI_SIMD_SSE2)
+
+/* Apart from the index lookup, the op for a pixel only depends on the pixel
+and its predecessor. qoi_encode_classify_*() compute it for QOI_ENCODE_BLOCK
+pixels from src, 4 (SSE2), 8 (AVX2) or 16 (AVX-512) pixels at a time. The
+predecessor of the first pixel is px_prev; the others are shifted in from the
+pixel vectors instead of being loaded from memory again. 3 channel pixels are
+expanded to words in registers, which reads up to 16 bytes past the block. The
+pixel words, holding r, g, b, a from the lowest to the highest byte, are stored
+to w. For each pixel, info receives
+ - byte 0: QOI_HASH() of the pixel
+ - byte 1: one of the QOI_CLASS_* below
+ - byte 2 and 3: the QOI_OP_DIFF byte or the two QOI_OP_LUMA bytes
+
+The vector code mirrors qoi_encode_span() with byte wise arithmetic:
+ - DIFF:  vr + 2, vg + 2 and vb + 2 all fit into 2 bits
+ - LUMA:  vg_r + 8 and vg_b + 8 fit into 4 bits, vg + 32 into 6 bits
+ - hash:  r * 3 + b * 7 and g * 5 + a * 11 in 16 bit lanes, added up */
+#define QOI_ENCODE_BLOCK 32
+
+#define QOI_CLASS_RUN  0
+#define QOI_CLASS_DIFF 1
+#define QOI_CLASS_LUMA 2
+#define QOI_CLASS_RGB  3
+#define QOI_CLASS_RGBA 4
+
+static void qoi_encode_classify_sse2(
+	const unsigned char *src, unsigned int px_prev, int channels,
+	unsigned int *w, unsigned int *info
+) {
+	const __m128i zero       = _mm_setzero_si128();
+	const __m128i lane_0     = _mm_setr_epi32(0x00ffffff, 0, 0, 0);
+	const __m128i lane_1     = _mm_setr_epi32(0, 0x00ffffff, 0, 0);
+	const __m128i lane_2     = _mm_setr_epi32(0, 0, 0x00ffffff, 0);
+	const __m128i lane_3     = _mm_setr_epi32(0, 0, 0, 0x00ffffff);
+	const __m128i mask_alpha = _mm_set1_epi32((int)0xff000000);
+	const __m128i mask_ff    = _mm_set1_epi32(0x000000ff);
+	const __m128i mask_3     = _mm_set1_epi32(0x00000003);
+	const __m128i mask_c     = _mm_set1_epi32(0x0000000c);
+	const __m128i mask_f     = _mm_set1_epi32(0x0000000f);
+	const __m128i mask_63    = _mm_set1_epi32(0x0000003f);
+	const __m128i mask_rb    = _mm_set1_epi32(0x00ff00ff);
+	const __m128i diff_bias  = _mm_set1_epi32(0x00020202);
+	const __m128i diff_range = _mm_set1_epi32(0x00fcfcfc);
+	const __m128i luma_bias  = _mm_set1_epi32(0x00082008);
+	const __m128i luma_range = _mm_set1_epi32(0x00f0c0f0);
+	const __m128i weights_rb = _mm_set1_epi32(0x00070003);
+	const __m128i weights_ga = _mm_set1_epi32(0x000b0005);
+	const __m128i op_diff    = _mm_set1_epi32(QOI_OP_DIFF);
+	const __m128i op_luma    = _mm_set1_epi32(QOI_OP_LUMA);
+	const __m128i class_diff = _mm_set1_epi32(QOI_CLASS_DIFF);
+	const __m128i class_luma = _mm_set1_epi32(QOI_CLASS_LUMA);
+	const __m128i class_rgb  = _mm_set1_epi32(QOI_CLASS_RGB);
+	const __m128i class_rgba = _mm_set1_epi32(QOI_CLASS_RGBA);
+	__m128i last = _mm_set1_epi32((int)px_prev);
+	__m128i alpha = _mm_and_si128(last, mask_alpha);
+	int i;
+
+	for (i = 0; i < QOI_ENCODE_BLOCK; i += 4) {
+		__m128i v, cur, prev, d, same, same_alpha, t, g, l, s;
+		__m128i diff_ok, luma_ok, diff, luma, hash, cls, code;
+
+		if (channels == 4) {
+			cur = _mm_loadu_si128((const __m128i *)(src + i * 4));
+		}
+		else {
+			/* Shift pixel k from byte 3 * k to byte 4 * k */
+			v = _mm_loadu_si128((const __m128i *)(src + i * 3));
+			cur = _mm_or_si128(
+				_mm_or_si128(
+					_mm_and_si128(v, lane_0),
+					_mm_and_si128(_mm_slli_si128(v, 1), lane_1)
+				),
+				_mm_or_si128(
+					_mm_and_si128(_mm_slli_si128(v, 2), lane_2),
+					_mm_and_si128(_mm_slli_si128(v, 3), lane_3)
+				)
+			);
+			cur = _mm_or_si128(cur, alpha);
+		}
+		prev = _mm_or_si128(_mm_slli_si128(cur, 4), _mm_srli_si128(last, 12));
+		last = cur;
+
+		d = _mm_sub_epi8(cur, prev);
+		same = _mm_cmpeq_epi32(cur, prev);
+		same_alpha = _mm_cmpeq_epi32(_mm_and_si128(d, mask_alpha), zero);
+
+		t = _mm_add_epi8(d, diff_bias);
+		diff_ok = _mm_and_si128(same_alpha, _mm_cmpeq_epi32(_mm_and_si128(t, diff_range), zero));
+		diff = _mm_or_si128(
+			_mm_or_si128(op_diff, _mm_slli_epi32(_mm_and_si128(t, mask_3), 4)),
+			_mm_or_si128(
+				_mm_and_si128(_mm_srli_epi32(t, 6), mask_c),
+				_mm_and_si128(_mm_srli_epi32(t, 16), mask_3)
+			)
+		);
+
+		g = _mm_and_si128(_mm_srli_epi32(d, 8), mask_ff);
+		l = _mm_add_epi8(_mm_sub_epi8(d, _mm_or_si128(g, _mm_slli_epi32(g, 16))), luma_bias);
+		luma_ok = _mm_and_si128(same_alpha, _mm_cmpeq_epi32(_mm_and_si128(l, luma_range), zero));
+		luma = _mm_or_si128(
+			_mm_or_si128(op_luma, _mm_and_si128(_mm_srli_epi32(l, 8), mask_ff)),
+			_mm_slli_epi32(_mm_or_si128(
+				_mm_slli_epi32(_mm_and_si128(l, mask_f), 4),
+				_mm_and_si128(_mm_srli_epi32(l, 16), mask_f)
+			), 8)
+		);
+
+		s = _mm_add_epi16(
+			_mm_mullo_epi16(_mm_and_si128(cur, mask_rb), weights_rb),
+			_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(cur, 8), mask_rb), weights_ga)
+		);
+		hash = _mm_and_si128(_mm_add_epi32(s, _mm_srli_epi32(s, 16)), mask_63);
+
+		cls = _mm_or_si128(_mm_and_si128(same_alpha, class_rgb), _mm_andnot_si128(same_alpha, class_rgba));
+		cls = _mm_or_si128(_mm_and_si128(luma_ok, class_luma), _mm_andnot_si128(luma_ok, cls));
+		cls = _mm_or_si128(_mm_and_si128(diff_ok, class_diff), _mm_andnot_si128(diff_ok, cls));
+		cls = _mm_andnot_si128(same, cls);
+		code = _mm_or_si128(_mm_and_si128(diff_ok, diff), _mm_andnot_si128(diff_ok, luma));
+
+		_mm_storeu_si128((__m128i *)(w + i), cur);
+		_mm_storeu_si128((__m128i *)(info + i), _mm_or_si128(
+			_mm_or_si128(hash, _mm_slli_epi32(cls, 8)),
+			_mm_slli_epi32(code, 16)
+		));
+	}
+}
+
+#if defined(QOI_SIMD_AVX2)
+static QOI_TARGET_AVX2 void qoi_encode_classify_avx2(
+	const unsigned char *src, unsigned int px_prev, int channels,
+	unsigned int *w, unsigned int *info
+) {
+	const __m256i zero       = _mm256_setzero_si256();
+	const __m256i rotate     = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);
+	const __m256i rgb_split  = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+	const __m256i rgb_expand = _mm256_setr_epi8(
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1
+	);
+	const __m256i mask_alpha = _mm256_set1_epi32((int)0xff000000);
+	const __m256i mask_ff    = _mm256_set1_epi32(0x000000ff);
+	const __m256i mask_3     = _mm256_set1_epi32(0x00000003);
+	const __m256i mask_c     = _mm256_set1_epi32(0x0000000c);
+	const __m256i mask_f     = _mm256_set1_epi32(0x0000000f);
+	const __m256i mask_63    = _mm256_set1_epi32(0x0000003f);
+	const __m256i mask_rb    = _mm256_set1_epi32(0x00ff00ff);
+	const __m256i diff_bias  = _mm256_set1_epi32(0x00020202);
+	const __m256i diff_range = _mm256_set1_epi32(0x00fcfcfc);
+	const __m256i luma_bias  = _mm256_set1_epi32(0x00082008);
+	const __m256i luma_range = _mm256_set1_epi32(0x00f0c0f0);
+	const __m256i weights_rb = _mm256_set1_epi32(0x00070003);
+	const __m256i weights_ga = _mm256_set1_epi32(0x000b0005);
+	const __m256i op_diff    = _mm256_set1_epi32(QOI_OP_DIFF);
+	const __m256i op_luma    = _mm256_set1_epi32(QOI_OP_LUMA);
+	const __m256i class_diff = _mm256_set1_epi32(QOI_CLASS_DIFF);
+	const __m256i class_luma = _mm256_set1_epi32(QOI_CLASS_LUMA);
+	const __m256i class_rgb  = _mm256_set1_epi32(QOI_CLASS_RGB);
+	const __m256i class_rgba = _mm256_set1_epi32(QOI_CLASS_RGBA);
+	__m256i last = _mm256_set1_epi32((int)px_prev);
+	__m256i alpha = _mm256_and_si256(last, mask_alpha);
+	int i;
+
+	for (i = 0; i < QOI_ENCODE_BLOCK; i += 8) {
+		__m256i v, cur, rot, prev, d, same, same_alpha, t, g, l, s;
+		__m256i diff_ok, luma_ok, diff, luma, hash, cls, code;
+
+		if (channels == 4) {
+			cur = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+		}
+		else {
+			/* Move pixels 4 to 7 into the upper 128 bit lane, then spread
+			the pixels of each lane to 4 bytes */
+			v = _mm256_loadu_si256((const __m256i *)(src + i * 3));
+			v = _mm256_permutevar8x32_epi32(v, rgb_split);
+			cur = _mm256_or_si256(_mm256_shuffle_epi8(v, rgb_expand), alpha);
+		}
+		rot = _mm256_permutevar8x32_epi32(cur, rotate);
+		prev = _mm256_blend_epi32(rot, last, 0x01);
+		last = rot;
+
+		d = _mm256_sub_epi8(cur, prev);
+		same = _mm256_cmpeq_epi32(cur, prev);
+		same_alpha = _mm256_cmpeq_epi32(_mm256_and_si256(d, mask_alpha), zero);
+
+		t = _mm256_add_epi8(d, diff_bias);
+		diff_ok = _mm256_and_si256(same_alpha, _mm256_cmpeq_epi32(_mm256_and_si256(t, diff_range), zero));
+		diff = _mm256_or_si256(
+			_mm256_or_si256(op_diff, _mm256_slli_epi32(_mm256_and_si256(t, mask_3), 4)),
+			_mm256_or_si256(
+				_mm256_and_si256(_mm256_srli_epi32(t, 6), mask_c),
+				_mm256_and_si256(_mm256_srli_epi32(t, 16), mask_3)
+			)
+		);
+
+		g = _mm256_and_si256(_mm256_srli_epi32(d, 8), mask_ff);
+		l = _mm256_add_epi8(_mm256_sub_epi8(d, _mm256_or_si256(g, _mm256_slli_epi32(g, 16))), luma_bias);
+		luma_ok = _mm256_and_si256(same_alpha, _mm256_cmpeq_epi32(_mm256_and_si256(l, luma_range), zero));
+		luma = _mm256_or_si256(
+			_mm256_or_si256(op_luma, _mm256_and_si256(_mm256_srli_epi32(l, 8), mask_ff)),
+			_mm256_slli_epi32(_mm256_or_si256(
+				_mm256_slli_epi32(_mm256_and_si256(l, mask_f), 4),
+				_mm256_and_si256(_mm256_srli_epi32(l, 16), mask_f)
+			), 8)
+		);
+
+		s = _mm256_add_epi16(
+			_mm256_mullo_epi16(_mm256_and_si256(cur, mask_rb), weights_rb),
+			_mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi32(cur, 8), mask_rb), weights_ga)
+		);
+		hash = _mm256_and_si256(_mm256_add_epi32(s, _mm256_srli_epi32(s, 16)), mask_63);
+
+		cls = _mm256_blendv_epi8(class_rgba, class_rgb, same_alpha);
+		cls = _mm256_blendv_epi8(cls, class_luma, luma_ok);
+		cls = _mm256_blendv_epi8(cls, class_diff, diff_ok);
+		cls = _mm256_andnot_si256(same, cls);
+		code = _mm256_blendv_epi8(luma, diff, diff_ok);
+
+		_mm256_storeu_si256((__m256i *)(w + i), cur);
+		_mm256_storeu_si256((__m256i *)(info + i), _mm256_or_si256(
+			_mm256_or_si256(hash, _mm256_slli_epi32(cls, 8)),
+			_mm256_slli_epi32(code, 16)
+		));
+	}
+}
+#endif
+
+#if defined(QOI_SIMD_AVX512)
+static QOI_TARGET_AVX512 void qoi_encode_classify_avx512(
+	const unsigned char *src, unsigned int px_prev, int channels,
+	unsigned int *w, unsigned int *info
+) {
+	const __m512i rotate     = _mm512_setr_epi32(15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14);
+	const __m512i rgb_split  = _mm512_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6, 6, 7, 8, 9, 9, 10, 11, 12);
+	const __m512i rgb_expand = _mm512_set4_epi32(0x800b0a09, 0x80080706, 0x80050403, 0x80020100);
+	const __m512i mask_alpha = _mm512_set1_epi32((int)0xff000000);
+	const __m512i mask_ff    = _mm512_set1_epi32(0x000000ff);
+	const __m512i mask_3     = _mm512_set1_epi32(0x00000003);
+	const __m512i mask_c     = _mm512_set1_epi32(0x0000000c);
+	const __m512i mask_f     = _mm512_set1_epi32(0x0000000f);
+	const __m512i mask_63    = _mm512_set1_epi32(0x0000003f);
+	const __m512i mask_rb    = _mm512_set1_epi32(0x00ff00ff);
+	const __m512i diff_bias  = _mm512_set1_epi32(0x00020202);
+	const __m512i diff_range = _mm512_set1_epi32(0x00fcfcfc);
+	const __m512i luma_bias  = _mm512_set1_epi32(0x00082008);
+	const __m512i luma_range = _mm512_set1_epi32(0x00f0c0f0);
+	const __m512i weights_rb = _mm512_set1_epi32(0x00070003);
+	const __m512i weights_ga = _mm512_set1_epi32(0x000b0005);
+	const __m512i op_diff    = _mm512_set1_epi32(QOI_OP_DIFF);
+	const __m512i op_luma    = _mm512_set1_epi32(QOI_OP_LUMA);
+	const __m512i class_diff = _mm512_set1_epi32(QOI_CLASS_DIFF);
+	const __m512i class_luma = _mm512_set1_epi32(QOI_CLASS_LUMA);
+	const __m512i class_rgb  = _mm512_set1_epi32(QOI_CLASS_RGB);
+	const __m512i class_rgba = _mm512_set1_epi32(QOI_CLASS_RGBA);
+	__m512i last = _mm512_set1_epi32((int)px_prev);
+	__m512i alpha = _mm512_and_si512(last, mask_alpha);
+	int i;
+
+	for (i = 0; i < QOI_ENCODE_BLOCK; i += 16) {
+		__m512i v, cur, rot, prev, d, t, g, l, s, diff, luma, hash, cls, code;
+		__mmask16 same, same_alpha, diff_ok, luma_ok;
+
+		if (channels == 4) {
+			cur = _mm512_loadu_si512((const void *)(src + i * 4));
+		}
+		else {
+			v = _mm512_loadu_si512((const void *)(src + i * 3));
+			v = _mm512_permutexvar_epi32(rgb_split, v);
+			cur = _mm512_or_si512(_mm512_shuffle_epi8(v, rgb_expand), alpha);
+		}
+		rot = _mm512_permutexvar_epi32(rotate, cur);
+		prev = _mm512_mask_blend_epi32(0x0001, rot, last);
+		last = rot;
+
+		d = _mm512_sub_epi8(cur, prev);
+		same = _mm512_cmpeq_epi32_mask(cur, prev);
+		same_alpha = _mm512_testn_epi32_mask(d, mask_alpha);
+
+		t = _mm512_add_epi8(d, diff_bias);
+		diff_ok = same_alpha & _mm512_testn_epi32_mask(t, diff_range);
+		diff = _mm512_or_si512(
+			_mm512_or_si512(op_diff, _mm512_slli_epi32(_mm512_and_si512(t, mask_3), 4)),
+			_mm512_or_si512(
+				_mm512_and_si512(_mm512_srli_epi32(t, 6), mask_c),
+				_mm512_and_si512(_mm512_srli_epi32(t, 16), mask_3)
+			)
+		);
+
+		g = _mm512_and_si512(_mm512_srli_epi32(d, 8), mask_ff);
+		l = _mm512_add_epi8(_mm512_sub_epi8(d, _mm512_or_si512(g, _mm512_slli_epi32(g, 16))), luma_bias);
+		luma_ok = same_alpha & _mm512_testn_epi32_mask(l, luma_range);
+		luma = _mm512_or_si512(
+			_mm512_or_si512(op_luma, _mm512_and_si512(_mm512_srli_epi32(l, 8), mask_ff)),
+			_mm512_slli_epi32(_mm512_or_si512(
+				_mm512_slli_epi32(_mm512_and_si512(l, mask_f), 4),
+				_mm512_and_si512(_mm512_srli_epi32(l, 16), mask_f)
+			), 8)
+		);
+
+		s = _mm512_add_epi16(
+			_mm512_mullo_epi16(_mm512_and_si512(cur, mask_rb), weights_rb),
+			_mm512_mullo_epi16(_mm512_and_si512(_mm512_srli_epi32(cur, 8), mask_rb), weights_ga)
+		);
+		hash = _mm512_and_si512(_mm512_add_epi32(s, _mm512_srli_epi32(s, 16)), mask_63);
+
+		cls = _mm512_mask_blend_epi32(same_alpha, class_rgba, class_rgb);
+		cls = _mm512_mask_blend_epi32(luma_ok, cls, class_luma);
+		cls = _mm512_mask_blend_epi32(diff_ok, cls, class_diff);
+		cls = _mm512_maskz_mov_epi32((__mmask16)~same, cls);
+		code = _mm512_mask_blend_epi32(diff_ok, luma, diff);
+
+		_mm512_storeu_si512((void *)(w + i), cur);
+		_mm512_storeu_si512((void *)(info + i), _mm512_or_si512(
+			_mm512_or_si512(hash, _mm512_slli_epi32(cls, 8)),
+			_mm512_slli_epi32(code, 16)
+		));
+	}
+}
+#endif
+
+/* Encode whole blocks of QOI_ENCODE_BLOCK pixels. Each block is classified
+with vector instructions first; the scalar pass then only has to resolve runs
+and index hits, which depend on the pixels before. Runs that start at the
+beginning of a block are measured in bulk instead. */
+QOI_FORCE_INLINE size_t qoi_encode_blocks(
+	qoi_rgba_t *index, qoi_rgba_t *px_prev_p, int *run_p,
+	const unsigned char *pixels, size_t *px_pos_p, size_t px_len, int channels, int isa,
+	unsigned char *bytes, size_t p
+) {
+	unsigned int w[QOI_ENCODE_BLOCK];
+	unsigned int info[QOI_ENCODE_BLOCK];
+	size_t px_pos = *px_pos_p;
+	size_t block_len = QOI_ENCODE_BLOCK * channels + (channels == 3 ? 16 : 0);
+	qoi_rgba_t px, px_prev = *px_prev_p;
+	int run = *run_p;
+	int i;
+
+	while (px_len - px_pos >= block_len) {
+		const unsigned char *src = pixels + px_pos;
+
+		if (memcmp(src, &px_prev, channels) == 0) {
+			size_t n = qoi_encode_run_length(src, px_len - px_pos, px_prev, channels, isa);
+			size_t total = (size_t)run + n;
+			memset(bytes + p, QOI_OP_RUN | (62 - 1), total / 62);
+			p += total / 62;
+			run = (int)(total % 62);
+			px_pos += n * channels;
+			continue;
+		}
+
+	#if defined(QOI_SIMD_AVX512)
+		if (isa == QOI_ISA_AVX512) {
+			qoi_encode_classify_avx512(src, px_prev.v, channels, w, info);
+		}
+		else
+	#endif
+	#if defined(QOI_SIMD_AVX2)
+		if (isa == QOI_ISA_AVX2) {
+			qoi_encode_classify_avx2(src, px_prev.v, channels, w, info);
+		}
+		else
+	#endif
+		{
+			qoi_encode_classify_sse2(src, px_prev.v, channels, w, info);
+		}
+
+		for (i = 0; i < QOI_ENCODE_BLOCK; i++) {
+			unsigned int in = info[i];
+			unsigned int cls = (in >> 8) & 0xff;
+			unsigned int index_pos = in & 0xff;
+
+			if (cls == QOI_CLASS_RUN) {
+				run++;
+				if (run == 62) {
+					bytes[p++] = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+				continue;
+			}
+
+			if (run > 0) {
+				bytes[p++] = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+
+			px.v = w[i];
+			if (index[index_pos].v == px.v) {
+				bytes[p++] = QOI_OP_INDEX | index_pos;
+				continue;
+			}
+			index[index_pos] = px;
+
+			if (cls == QOI_CLASS_DIFF) {
+				bytes[p++] = (unsigned char)(in >> 16);
+			}
+			else if (cls == QOI_CLASS_LUMA) {
+				bytes[p++] = (unsigned char)(in >> 16);
+				bytes[p++] = (unsigned char)(in >> 24);
+			}
+			else if (cls == QOI_CLASS_RGB) {
+				bytes[p++] = QOI_OP_RGB;
+				memcpy(bytes + p, &px, 4);
+				p += 3;
+			}
+			else {
+				bytes[p++] = QOI_OP_RGBA;
+				memcpy(bytes + p, &px, 4);
+				p += 4;
+			}
+		}
+
+		px_prev.v = w[QOI_ENCODE_BLOCK - 1];
+		px_pos += QOI_ENCODE_BLOCK * channels;
+	}
+
+	*px_prev_p = px_prev;
+	*run_p = run;
+	*px_pos_p = px_pos;
+	return p;
+}
+
+#endif /* QOI_SIMD_SSE2 */
+
+QOI_FORCE_INLINE size_t qoi_encode_span_isa(
+	qoi_rgba_t *index, qoi_rgba_t *px_prev, int *run,
+	const unsigned char *pixels, size_t px_len, int channels, int isa,
+	unsigned char *bytes, size_t p
+) {
+	size_t px_pos = 0;
+
+	if (channels == 4) {
+	#if defined(QOI_SIMD_SSE2)
+		if (isa != QOI_ISA_SCALAR) {
+			p = qoi_encode_blocks(index, px_prev, run, pixels, &px_pos, px_len, 4, isa, bytes, p);
+		}
+	#endif
+		p = qoi_encode_bulk(index, px_prev, run, pixels, &px_pos, px_len, 4, isa, bytes, p);
+	}
+	else {
+	#if defined(QOI_SIMD_SSE2)
+		if (isa != QOI_ISA_SCALAR) {
+			p = qoi_encode_blocks(index, px_prev, run, pixels, &px_pos, px_len, 3, isa, bytes, p);
+		}
+	#endif
+		p = qoi_encode_bulk(index, px_prev, run, pixels, &px_pos, px_len, 3, isa, bytes, p);
+	}
+
+	return qoi_encode_span(
+		index, px_prev, run, pixels + px_pos, px_len - px_pos, channels,
+		bytes, p
+	);
+}
+
+#if defined(QOI_SIMD_SSE2)
+static size_t qoi_encode_span_sse2(
+	qoi_rgba_t *index, qoi_rgba_t *px_prev, int *run,
+	const unsigned char *pixels, size_t px_len, int channels,
+	unsigned char *bytes, size_t p
+) {
+	return qoi_encode_span_isa(index, px_prev, run, pixels, px_len, channels, QOI_ISA_SSE2, bytes, p);
+}
+#endif
+
+#if defined(QOI_SIMD_AVX2)
+static QOI_TARGET_AVX2 size_t qoi_encode_span_avx2(
+	qoi_rgba_t *index, qoi_rgba_t *px_prev, int *run,
+	const unsigned char *pixels, size_t px_len, int channels,
+	unsigned char *bytes, size_t p
+) {
+	return qoi_encode_span_isa(index, px_prev, run, pixels, px_len, channels, QOI_ISA_AVX2, bytes, p);
+}
+#endif
+
+#if defined(QOI_SIMD_AVX512)
+static QOI_TARGET_AVX512 size_t qoi_encode_span_avx512(
+	qoi_rgba_t *index, qoi_rgba_t *px_prev, int *run,
+	const unsigned char *pixels, size_t px_len, int channels,
+	unsigned char *bytes, size_t p
+) {
+	return qoi_encode_span_isa(index, px_prev, run, pixels, px_len, channels, QOI_ISA_AVX512, bytes, p);
+}
+#endif
+
+static size_t qoi_encode_span_fast(
+	qoi_rgba_t *index, qoi_rgba_t *px_prev, int *run,
+	const unsigned char *pixels, size_t px_len, int channels,
+	unsigned char *bytes, size_t p
+) {
+#if defined(QOI_SIMD_AVX512)
+	if (qoi_cpu_isa() == QOI_ISA_AVX512) {
+		return qoi_encode_span_avx512(index, px_prev, run, pixels, px_len, channels, bytes, p);
+	}
+#endif
+#if defined(QOI_SIMD_AVX2)
+	if (qoi_cpu_isa() == QOI_ISA_AVX2) {
+		return qoi_encode_span_avx2(index, px_prev, run, pixels, px_len, channels, bytes, p);
+	}
+#endif
+#if defined(QOI_SIMD_SSE2)
+	return qoi_encode_span_sse2(index, px_prev, run, pixels, px_len, channels, bytes, p);
+#else
+	return qoi_encode_span_isa(index, px_prev, run, pixels, px_len, channels, QOI_ISA_SCALAR, bytes, p);
+#endif
+}
+
+static void qoi_init_state(qoi_rgba_t *px, int *run) {
+	px->rgba.r = 0;
+	px->rgba.g = 0;
+	px->rgba.b = 0;
+	px->rgba.a = 255;
+	*run = 0;
+}
+
+static size_t qoi_write_header(unsigned char *bytes, size_t p, const qoi_desc *desc) {
+	qoi_write_32(bytes, &p, QOI_MAGIC);
+	qoi_write_32(bytes, &p, desc->width);
+	qoi_write_32(bytes, &p, desc->height);
+	bytes[p++] = desc->channels;
+	bytes[p++] = desc->colorspace;
+	return p;
+}
+
+/* Compute a * b + c, or return 0 if the result does not fit into a size_t */
+static int qoi_size_mad(size_t a, size_t b, size_t c, size_t *out) {
+	if (b != 0 && a > ((size_t)-1 - c) / b) {
+		return 0;
+	}
+	*out = a * b + c;
+	return 1;
+}
+
+static int qoi_valid_desc(const qoi_desc *desc) {
+	return
+		desc->width != 0 && desc->height != 0 &&
+		desc->channels >= 3 && desc->channels <= 4 &&
+		desc->colorspace <= 1;
+}
+
+size_t qoi_max_encoded_size(const qoi_desc *desc) {
+	size_t px_count, max_size;
+
+	if (
+		desc == NULL || !qoi_valid_desc(desc) ||
+		!qoi_size_mad(desc->width, desc->height, 0, &px_count) ||
+		!qoi_size_mad(
+			px_count, desc->channels + 1,
+			QOI_HEADER_SIZE + sizeof(qoi_padding), &max_size
+		)
+	) {
+		return 0;
+	}
+	return max_size;
+}
+
+/* Encode px_count pixels like qoi_encode_span(), but never write past out_size,
+leaving room for the end marker. Returns the new position or 0 if the encoded
+pixels do not fit.
+
+Each pixel produces at most channels + 1 bytes, plus one byte to terminate a
+run that is still open from before. Pixels are encoded in chunks that are
+guaranteed to fit; if the buffer is too small for the worst case, the last few
+pixels are encoded one by one through a scratch buffer. */
+static size_t qoi_encode_span_bounded(
+	qoi_rgba_t *index, qoi_rgba_t *px_prev, int *run,
+	const unsigned char *pixels, size_t px_count, int channels,
+	unsigned char *bytes, size_t p, size_t out_size
+) {
+	while (px_count > 0) {
+		size_t avail = out_size - p - sizeof(qoi_padding);
+		size_t open_run = *run > 0 ? 1 : 0;
+		size_t n = avail > open_run ? (avail - open_run) / (channels + 1) : 0;
+		if (n > px_count) {
+			n = px_count;
+		}
+		if (n > 0) {
+			p = qoi_encode_span_fast(
+				index, px_prev, run, pixels, n * channels, channels,
+				bytes, p
+			);
+		}
+		else {
+			unsigned char scratch[8];
+			size_t len = qoi_encode_span(
+				index, px_prev, run, pixels, channels, channels,
+				scratch, 0
+			);
+			if (len > avail) {
+				return 0;
+			}
+			memcpy(bytes + p, scratch, len);
+			p += len;
+			n = 1;
+		}
+		pixels += n * channels;
+		px_count -= n;
+	}
+	return p;
+}
+
+size_t qoi_encode_rect(
+	const void *pixels, ptrdiff_t stride, unsigned int x, unsigned int y,
+	const qoi_desc *desc, void *out, size_t out_size
+) {
+	size_t i, p, row_len;
+	unsigned int row;
+	int run, channels;
+	unsigned char *bytes;
+	const unsigned char *src;
+	qoi_rgba_t index[64];
+	qoi_rgba_t px_prev;
+
+	if (
+		pixels == NULL || out == NULL || qoi_max_encoded_size(desc) == 0 ||
+		out_size < QOI_HEADER_SIZE + 1 + sizeof(qoi_padding)
+	) {
+		return 0;
+	}
+
+	bytes = (unsigned char *)out;
+	channels = desc->channels;
+	row_len = (size_t)desc->width * channels;
+	src = (const unsigned char *)pixels + (ptrdiff_t)y * stride + (size_t)x * channels;
+
+	p = 0;
+	p = qoi_write_header(bytes, p, desc);
+
+	QOI_ZEROARR(index);
+	qoi_init_state(&px_prev, &run);
+
+	if (stride == (ptrdiff_t)row_len) {
+		/* Tightly packed rows can be encoded in one go */
+		p = qoi_encode_span_bounded(
+			index, &px_prev, &run, src, (size_t)desc->width * desc->height, channels,
+			bytes, p, out_size
+		);
+	}
+	else {
+		for (row = 0; row < desc->height && p != 0; row++) {
+			p = qoi_encode_span_bounded(
+				index, &px_prev, &run, src, desc->width, channels,
+				bytes, p, out_size
+			);
+			src += stride;
+		}
+	}
+
+	if (p == 0 || (run > 0 && out_size - p - sizeof(qoi_padding) < 1)) {
+		return 0;
+	}
+	p = qoi_encode_end_run(&run, bytes, p);
+
+	for (i = 0; i < sizeof(qoi_padding); i++) {
+		bytes[p++] = qoi_padding[i];
+	}
+
+	return p;
+}
+
+size_t qoi_encode_into(const void *data, const qoi_desc *desc, void *out, size_t out_size) {
+	if (desc == NULL) {
+		return 0;
+	}
+	return qoi_encode_rect(
+		data, (ptrdiff_t)desc->width * desc->channels, 0, 0,
+		desc, out, out_size
+	);
+}
+
+/* Pixels per block converted by qoi_encode_format(). A block of RGBA pixels
+takes 2KB, small enough to be encoded while still in the L1 cache. */
+#define QOI_CONVERT_BLOCK 512
+
+/* Convert n pixels from a source format to RGB or RGBA */
+static void qoi_convert_src(
+	const unsigned char *src, int format, unsigned char *dst, size_t n, int channels
+) {
+	size_t i;
+	int bpp = qoi_format_size(format);
+
+	#define QOI_CONVERT(R, G, B, A) \
+		for (i = 0; i < n; i++, src += bpp, dst += channels) { \
+			dst[0] = R; \
+			dst[1] = G; \
+			dst[2] = B; \
+			if (channels == 4) { \
+				dst[3] = A; \
+			} \
+		}
+	switch (format) {
+		case QOI_FORMAT_RGB:  QOI_CONVERT(src[0], src[1], src[2], 255); break;
+		case QOI_FORMAT_RGBA: QOI_CONVERT(src[0], src[1], src[2], src[3]); break;
+		case QOI_FORMAT_RGBX: QOI_CONVERT(src[0], src[1], src[2], 255); break;
+		case QOI_FORMAT_BGRA: QOI_CONVERT(src[2], src[1], src[0], src[3]); break;
+		case QOI_FORMAT_BGRX: QOI_CONVERT(src[2], src[1], src[0], 255); break;
+		case QOI_FORMAT_ARGB: QOI_CONVERT(src[1], src[2], src[3], src[0]); break;
+		case QOI_FORMAT_GRAY: QOI_CONVERT(src[0], src[0], src[0], 255); break;
+		case QOI_FORMAT_GRAY16:
+			for (i = 0; i < n; i++, src += 2, dst += channels) {
+				unsigned short v;
+				memcpy(&v, src, 2);
+				dst[0] = dst[1] = dst[2] = (unsigned char)((v + 128u) / 257u);
+				if (channels == 4) {
+					dst[3] = 255;
+				}
+			}
+			break;
+	}
+	#undef QOI_CONVERT
+}
+
+size_t qoi_encode_format(
+	const void *pixels, ptrdiff_t stride, int format,
+	const qoi_desc *desc, void *out, size_t out_size
+) {
+	unsigned char block[QOI_CONVERT_BLOCK * 4];
+	const unsigned char *src;
+	unsigned char *bytes;
+	qoi_rgba_t index[64];
+	qoi_rgba_t px_prev;
+	size_t i, p, n, x, bpp;
+	unsigned int row;
+	int run, channels;
+
+	if (
+		pixels == NULL || out == NULL || qoi_max_encoded_size(desc) == 0 ||
+		out_size < QOI_HEADER_SIZE + 1 + sizeof(qoi_padding) ||
+		qoi_format_size(format) == 0 ||
+		format == QOI_FORMAT_RGBA_PREMUL || format == QOI_FORMAT_BGRA_PREMUL ||
+		format == QOI_FORMAT_RGB565
+	) {
+		return 0;
+	}
+
+	channels = desc->channels;
+	bpp = qoi_format_size(format);
+	if (stride == 0) {
+		stride = (ptrdiff_t)(desc->width * bpp);
+	}
+
+	/* Pixels that are already in the layout of the image need no conversion */
+	if (format == channels) {
+		return qoi_encode_rect(pixels, stride, 0, 0, desc, out, out_size);
+	}
+
+	bytes = (unsigned char *)out;
+	p = qoi_write_header(bytes, 0, desc);
+	QOI_ZEROARR(index);
+	qoi_init_state(&px_prev, &run);
+
+	src = (const unsigned char *)pixels;
+	for (row = 0; row < desc->height && p != 0; row++) {
+		for (x = 0; x < desc->width && p != 0; x += n) {
+			n = desc->width - x < QOI_CONVERT_BLOCK ? desc->width - x : QOI_CONVERT_BLOCK;
+			qoi_convert_src(src + x * bpp, format, block, n, channels);
+			p = qoi_encode_span_bounded(
+				index, &px_prev, &run, block, n, channels,
+				bytes, p, out_size
+			);
+		}
+		src += stride;
+	}
+
+	if (p == 0 || (run > 0 && out_size - p - sizeof(qoi_padding) < 1)) {
+		return 0;
+	}
+	p = qoi_encode_end_run(&run, bytes, p);
+
+	for (i = 0; i < sizeof(qoi_padding); i++) {
+		bytes[p++] = qoi_padding[i];
+	}
+
+	return p;
+}
+
+static void *qoi_default_alloc(void *user, size_t size, size_t align) {
+	(void)user;
+	(void)align;
+	return QOI_MALLOC(size);
+}
+
+static void qoi_default_free(void *user, void *ptr, size_t size) {
+	(void)user;
+	(void)size;
+	QOI_FREE(ptr);
+}
+
+void qoi_ctx_init(qoi_ctx *ctx, qoi_alloc_fn alloc, qoi_free_fn free, void *user) {
+	memset(ctx, 0, sizeof(qoi_ctx));
+
+	/* An allocator without its free, or vice versa, can not be used */
+	if (alloc == NULL || free == NULL) {
+		alloc = qoi_default_alloc;
+		free = qoi_default_free;
+	}
+	ctx->alloc = alloc;
+	ctx->free = free;
+	ctx->user = user;
+}
+
+void qoi_ctx_release(qoi_ctx *ctx) {
+	if (ctx->buffer) {
+		ctx->free(ctx->user, ctx->buffer, ctx->buffer_size);
+	}
+	if (ctx->scratch) {
+		ctx->free(ctx->user, ctx->scratch, ctx->scratch_size);
+	}
+	ctx->buffer = ctx->scratch = NULL;
+	ctx->buffer_size = ctx->scratch_size = 0;
+}
+
+/* Make sure that the buffer holds at least size bytes, replacing it with a
+larger one if needed */
+static void *qoi_ctx_reserve(qoi_ctx *ctx, void **buffer, size_t *buffer_size, size_t size) {
+	if (*buffer_size < size || *buffer == NULL) {
+		if (*buffer) {
+			ctx->free(ctx->user, *buffer, *buffer_size);
+		}
+		*buffer = ctx->alloc(ctx->user, size, QOI_CTX_ALIGN);
+		*buffer_size = *buffer ? size : 0;
+	}
+	return *buffer;
+}
+
+/* Allocate and free temporary memory with the allocator of ctx, or with
+QOI_MALLOC and QOI_FREE if ctx is NULL */
+static void *qoi_alloc(qoi_ctx *ctx, size_t size) {
+	return ctx ? ctx->alloc(ctx->user, size, QOI_CTX_ALIGN) : QOI_MALLOC(size);
+}
+
+static void qoi_free(qoi_ctx *ctx, void *ptr, size_t size) {
+	if (ptr == NULL) {
+		return;
+	}
+	if (ctx) {
+		ctx->free(ctx->user, ptr, size);
+	}
+	else {
+		QOI_FREE(ptr);
+	}
+}
+
+/* Allocate the buffer returned by a function: the buffer of ctx, which the
+context keeps, or a new one that the caller free()s if ctx is NULL.
+qoi_free_out() releases it again on failure. */
+static void *qoi_alloc_out(qoi_ctx *ctx, size_t size) {
+	return ctx ? qoi_ctx_reserve(ctx, &ctx->buffer, &ctx->buffer_size, size) : QOI_MALLOC(size);
+}
+
+static void qoi_free_out(qoi_ctx *ctx, void *ptr) {
+	if (ctx == NULL && ptr != NULL) {
+		QOI_FREE(ptr);
+	}
+}
+
+void *qoi_encode64(const void *data, const qoi_desc *desc, size_t *out_len) {
+	return qoi_ctx_encode(NULL, data, desc, 1, out_len);
+}
+
+void *qoi_encode(const void *data, const qoi_desc *desc, int *out_len) {
+	size_t size;
+	void *bytes;
+
+	if (
+		out_len == NULL || desc == NULL || desc->width == 0 ||
+		desc->height >= QOI_PIXELS_MAX / desc->width
+	) {
+		return NULL;
+	}
+
+	bytes = qoi_encode64(data, desc, &size);
+	if (bytes) {
+		*out_len = (int)size;
+	}
+	return bytes;
+}
+
+/* Threads for the parallel functions. qoi_parallel_for() calls fn(user, i) for
+each i in 0..count on up to nthreads threads, including the calling thread.
+Threads take the next i from a shared counter until all are done. At most
+QOI_THREADS_MAX threads are used. If threads are not available or can not be
+started, the remaining work is done by the threads that are running, at worst
+by the calling thread alone. */
+
+#if !defined(QOI_NO_THREADS) && defined(_WIN32)
+	#define QOI_THREADS_WIN32
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+	#include <process.h>
+	#define QOI_ATOMIC_NEXT(p) ((size_t)InterlockedIncrement(p) - 1)
+#elif !defined(QOI_NO_THREADS) && \
+	(defined(__unix__) || defined(__APPLE__)) && \
+	(defined(__GNUC__) || defined(__clang__))
+	#define QOI_THREADS_PTHREAD
+	#include <pthread.h>
+	#define QOI_ATOMIC_NEXT(p) ((size_t)__atomic_fetch_add(p, 1, __ATOMIC_RELAXED))
+#else
+	#define QOI_ATOMIC_NEXT(p) ((size_t)(*(p))++)
+#endif
+
+#define QOI_THREADS_MAX 256
+
+typedef void (*qoi_task_fn)(void *user, size_t i);
+
+typedef struct {
+	qoi_task_fn fn;
+	void *user;
+	size_t count;
+	volatile long next;
+} qoi_pool_t;
+
+static void qoi_pool_work(qoi_pool_t *pool) {
+	size_t i;
+	while ((i = QOI_ATOMIC_NEXT(&pool->next)) < pool->count) {
+		pool->fn(pool->user, i);
+	}
+}
+
+#if defined(QOI_THREADS_WIN32)
+static unsigned __stdcall qoi_pool_main(void *pool) {
+	qoi_pool_work((qoi_pool_t *)pool);
+	return 0;
+}
+#elif defined(QOI_THREADS_PTHREAD)
+static void *qoi_pool_main(void *pool) {
+	qoi_pool_work((qoi_pool_t *)pool);
+	return NULL;
+}
+#endif
+
+static void qoi_parallel_for(qoi_task_fn fn, void *user, size_t count, int nthreads) {
+	qoi_pool_t pool;
+
+	pool.fn = fn;
+	pool.user = user;
+	pool.count = count;
+	pool.next = 0;
+
+	if (count > 0 && (size_t)nthreads > count) {
+		nthreads = (int)count;
+	}
+
+#if defined(QOI_THREADS_WIN32) || defined(QOI_THREADS_PTHREAD)
+	if (nthreads > 1) {
+	#if defined(QOI_THREADS_WIN32)
+		HANDLE threads[QOI_THREADS_MAX - 1];
+	#else
+		pthread_t threads[QOI_THREADS_MAX - 1];
+	#endif
+		int i, started = 0;
+
+		if (nthreads > QOI_THREADS_MAX) {
+			nthreads = QOI_THREADS_MAX;
+		}
+		for (i = 0; i < nthreads - 1; i++) {
+		#if defined(QOI_THREADS_WIN32)
+			threads[started] = (HANDLE)_beginthreadex(NULL, 0, qoi_pool_main, &pool, 0, NULL);
+			started += threads[started] != 0;
+		#else
+			started += pthread_create(&threads[started], NULL, qoi_pool_main, &pool) == 0;
+		#endif
+		}
+		qoi_pool_work(&pool);
+		for (i = 0; i < started; i++) {
+		#if defined(QOI_THREADS_WIN32)
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+		#else
+			pthread_join(threads[i], NULL);
+		#endif
+		}
+		return;
+	}
+#endif
+	qoi_pool_work(&pool);
+}
+
+/* The parallel encoder splits the image into stripes of whole pixels. The
+encoder state at the start of a stripe only depends on the pixels before it:
+px_prev is the pixel right before the stripe and each index slot holds the last
+pixel with that hash, except for the pixels of a run of the initial px_prev at
+the very start of the image, which the encoder never puts into the index.
+
+The first pass finds, for each stripe, the last position of every hash in the
+stripe by scanning it backwards; this usually stops after a few hundred
+pixels, once all slots are found. Merging these in order gives the index at the
+start of every stripe.
+
+The second pass encodes each stripe into its own part of the output buffer,
+without the pixels at its start that repeat the previous pixel. These and the
+run left open at the end of the previous stripe are one run in the serial
+encoder, so the QOI_OP_RUN bytes for it are written when the stripes are joined.
+Each pixel takes at most channels + 1 bytes, so the output written up to the
+end of a stripe never reaches into the part of the next stripe. */
+
+#define QOI_PARALLEL_MIN_PIXELS 65536
+
+typedef struct {
+	size_t px_start, px_end;
+	size_t first;           /* first pixel that is not the initial px_prev */
+	size_t last_pos[64];    /* last position of each hash, or (size_t)-1 */
+	qoi_rgba_t index[64];
+	size_t lead;            /* leading pixels that repeat px_prev */
+	size_t offset, len;
+	int run;
+} qoi_stripe_t;
+
+typedef struct {
+	const unsigned char *pixels;
+	int channels;
+	unsigned char *bytes;
+	qoi_stripe_t *stripes;
+} qoi_parallel_encode_t;
+
+QOI_FORCE_INLINE qoi_rgba_t qoi_load_px(const unsigned char *pixels, size_t i, int channels) {
+	qoi_rgba_t px;
+	px.rgba.r = pixels[i * channels + 0];
+	px.rgba.g = pixels[i * channels + 1];
+	px.rgba.b = pixels[i * channels + 2];
+	px.rgba.a = channels == 4 ? pixels[i * channels + 3] : 255;
+	return px;
+}
+
+static void qoi_encode_stripe_scan(void *user, size_t k) {
+	qoi_parallel_encode_t *job = (qoi_parallel_encode_t *)user;
+	qoi_stripe_t *s = &job->stripes[k];
+	qoi_rgba_t px, px_init;
+	size_t i;
+	int run, found = 0;
+
+	qoi_init_state(&px_init, &run);
+	for (s->first = s->px_start; s->first < s->px_end; s->first++) {
+		if (qoi_load_px(job->pixels, s->first, job->channels).v != px_init.v) {
+			break;
+		}
+	}
+
+	for (i = 0; i < 64; i++) {
+		s->last_pos[i] = (size_t)-1;
+	}
+	for (i = s->px_end; i > s->px_start && found < 64; i--) {
+		int index_pos;
+		px = qoi_load_px(job->pixels, i - 1, job->channels);
+		index_pos = QOI_HASH(px);
+		if (s->last_pos[index_pos] == (size_t)-1) {
+			s->last_pos[index_pos] = i - 1;
+			found++;
+		}
+	}
+}
+
+static void qoi_encode_stripe(void *user, size_t k) {
+	qoi_parallel_encode_t *job = (qoi_parallel_encode_t *)user;
+	qoi_stripe_t *s = &job->stripes[k];
+	int channels = job->channels;
+	qoi_rgba_t px_prev;
+
+	if (s->px_start == 0) {
+		qoi_init_state(&px_prev, &s->run);
+	}
+	else {
+		px_prev = qoi_load_px(job->pixels, s->px_start - 1, channels);
+	}
+	s->run = 0;
+
+	for (s->lead = 0; s->px_start + s->lead < s->px_end; s->lead++) {
+		if (qoi_load_px(job->pixels, s->px_start + s->lead, channels).v != px_prev.v) {
+			break;
+		}
+	}
+
+	s->len = qoi_encode_span_fast(
+		s->index, &px_prev, &s->run,
+		job->pixels + (s->px_start + s->lead) * channels,
+		(s->px_end - s->px_start - s->lead) * channels, channels,
+		job->bytes + s->offset, 0
+	);
+}
+
+static size_t qoi_encode_run_bytes(size_t run, unsigned char *bytes, size_t p) {
+	memset(bytes + p, QOI_OP_RUN | (62 - 1), run / 62);
+	p += run / 62;
+	if (run % 62) {
+		bytes[p++] = QOI_OP_RUN | (run % 62 - 1);
+	}
+	return p;
+}
+
+/* Encode into bytes, which must hold qoi_max_encoded_size(desc) bytes. The
+stripes are kept in the scratch buffer of ctx, if given. Returns the encoded
+size, or 0 if memory for the stripes could not be allocated. */
+static size_t qoi_encode_parallel_into(
+	const void *data, const qoi_desc *desc, int nthreads, unsigned char *bytes, qoi_ctx *ctx
+) {
+	qoi_parallel_encode_t job;
+	qoi_stripe_t *stripes;
+	size_t px_count, n, k, i, p, first, run;
+
+	px_count = (size_t)desc->width * desc->height;
+	n = nthreads > 1 ? (size_t)nthreads : 1;
+	if (n > px_count / QOI_PARALLEL_MIN_PIXELS) {
+		n = px_count / QOI_PARALLEL_MIN_PIXELS;
+	}
+	if (n <= 1) {
+		return qoi_encode_into(data, desc, bytes, qoi_max_encoded_size(desc));
+	}
+
+	job.pixels = (const unsigned char *)data;
+	job.channels = desc->channels;
+	job.bytes = bytes;
+	job.stripes = stripes = ctx
+		? (qoi_stripe_t *)qoi_ctx_reserve(ctx, &ctx->scratch, &ctx->scratch_size, sizeof(qoi_stripe_t) * n)
+		: (qoi_stripe_t *) QOI_MALLOC(sizeof(qoi_stripe_t) * n);
+	if (!stripes) {
+		return 0;
+	}
+
+	for (k = 0; k < n; k++) {
+		stripes[k].px_start = px_count / n * k;
+		stripes[k].px_end = k == n - 1 ? px_count : px_count / n * (k + 1);
+		stripes[k].offset = QOI_HEADER_SIZE + stripes[k].px_start * (desc->channels + 1);
+	}
+
+#if defined(QOI_SIMD_SSE2)
+	qoi_cpu_isa();
+#endif
+	qoi_parallel_for(qoi_encode_stripe_scan, &job, n, nthreads);
+
+	/* Pixels before the first one that differs from the initial px_prev are
+	never put into the index */
+	first = px_count;
+	for (k = 0; k < n && first == px_count; k++) {
+		if (stripes[k].first < stripes[k].px_end) {
+			first = stripes[k].first;
+		}
+	}
+
+	QOI_ZEROARR(stripes[0].index);
+	for (k = 1; k < n; k++) {
+		memcpy(stripes[k].index, stripes[k - 1].index, sizeof(stripes[k].index));
+		for (i = 0; i < 64; i++) {
+			size_t pos = stripes[k - 1].last_pos[i];
+			if (pos != (size_t)-1 && pos >= first) {
+				stripes[k].index[i] = qoi_load_px(job.pixels, pos, job.channels);
+			}
+		}
+	}
+
+	qoi_parallel_for(qoi_encode_stripe, &job, n, nthreads);
+
+	/* Join the stripes, moving each one to its final position */
+	p = qoi_write_header(bytes, 0, desc);
+	run = 0;
+	for (k = 0; k < n; k++) {
+		run += stripes[k].lead;
+		if (stripes[k].len > 0) {
+			size_t run_len = run / 62 + (run % 62 != 0);
+			memmove(bytes + p + run_len, bytes + stripes[k].offset, stripes[k].len);
+			p = qoi_encode_run_bytes(run, bytes, p);
+			p += stripes[k].len;
+			run = (size_t)stripes[k].run;
+		}
+	}
+	p = qoi_encode_run_bytes(run, bytes, p);
+
+	for (i = 0; i < sizeof(qoi_padding); i++) {
+		bytes[p++] = qoi_padding[i];
+	}
+
+	if (!ctx) {
+		QOI_FREE(stripes);
+	}
+	return p;
+}
+
+void *qoi_encode_parallel(const void *data, const qoi_desc *desc, int nthreads, size_t *out_len) {
+	return qoi_ctx_encode(NULL, data, desc, nthreads, out_len);
+}
+
+void *qoi_ctx_encode(qoi_ctx *ctx, const void *data, const qoi_desc *desc, int nthreads, size_t *out_len) {
+	size_t max_size;
+	unsigned char *bytes;
+
+	max_size = qoi_max_encoded_size(desc);
+	if (data == NULL || out_len == NULL || max_size == 0) {
+		return NULL;
+	}
+
+	bytes = (unsigned char *) qoi_alloc_out(ctx, max_size);
+	if (!bytes) {
+		return NULL;
+	}
+
+	*out_len = qoi_encode_parallel_into(data, desc, nthreads, bytes, ctx);
+	if (*out_len == 0) {
+		qoi_free_out(ctx, bytes);
+		return NULL;
+	}
+	return bytes;
+}
+
+static int qoi_encoder_flush(qoi_encoder *enc) {
+	if (enc->len > 0 && !enc->error) {
+		if (!enc->write(enc->user, enc->buffer, enc->len)) {
+			enc->error = 1;
+		}
+		enc->len = 0;
+	}
+	return !enc->error;
+}
+
+int qoi_encoder_init(qoi_encoder *enc, const qoi_desc *desc, qoi_write_fn write, void *user) {
+	if (enc == NULL) {
+		return 0;
+	}
+
+	enc->error = 1;
+	if (desc == NULL || write == NULL || !qoi_valid_desc(desc)) {
+		return 0;
+	}
+
+	enc->error = 0;
+	enc->write = write;
+	enc->user = user;
+	enc->channels = desc->channels;
+	enc->px_left = (unsigned long long)desc->width * desc->height;
+	QOI_ZEROARR(enc->index);
+	qoi_init_state(&enc->px_prev, &enc->run);
+	enc->len = (int)qoi_write_header(enc->buffer, 0, desc);
+	return 1;
+}
+
+int qoi_encoder_push(qoi_encoder *enc, const void *pixels, size_t count) {
+	const unsigned char *px = (const unsigned char *)pixels;
+	int channels, max_px;
+
+	if (enc == NULL || enc->error) {
+		return 0;
+	}
+	if (pixels == NULL || count > enc->px_left) {
+		enc->error = 1;
+		return 0;
+	}
+
+	/* Encode in chunks that are guaranteed to fit into the buffer. Each pixel
+	produces at most channels + 1 bytes, plus one byte for a pending run. */
+	channels = enc->channels;
+	max_px = (QOI_ENCODER_BUFFER_SIZE - 1) / (channels + 1);
+	enc->px_left -= count;
+	while (count > 0) {
+		int n = (QOI_ENCODER_BUFFER_SIZE - enc->len - 1) / (channels + 1);
+		if (n < max_px / 2 && !qoi_encoder_flush(enc)) {
+			return 0;
+		}
+		n = (QOI_ENCODER_BUFFER_SIZE - enc->len - 1) / (channels + 1);
+		if ((size_t)n > count) {
+			n = (int)count;
+		}
+		enc->len = (int)qoi_encode_span_fast(
+			enc->index, &enc->px_prev, &enc->run,
+			px, (size_t)n * channels, channels,
+			enc->buffer, enc->len
+		);
+		px += n * channels;
+		count -= n;
+	}
+	return 1;
+}
+
+int qoi_encoder_finish(qoi_encoder *enc) {
+	int i;
+
+	if (enc == NULL || enc->error) {
+		return 0;
+	}
+	if (enc->px_left != 0) {
+		enc->error = 1;
+		return 0;
+	}
+	if (QOI_ENCODER_BUFFER_SIZE - enc->len < 1 + (int)sizeof(qoi_padding)) {
+		qoi_encoder_flush(enc);
+	}
+
+	enc->len = (int)qoi_encode_end_run(&enc->run, enc->buffer, enc->len);
+	for (i = 0; i < (int)sizeof(qoi_padding); i++) {
+		enc->buffer[enc->len++] = qoi_padding[i];
+	}
+	if (!qoi_encoder_flush(enc)) {
+		return 0;
+	}
+
+	/* The image is complete; any further calls fail */
+	enc->error = 1;
+	return 1;
+}
+
+int qoi_read_header(const void *data, size_t size, qoi_desc *desc) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned int header_magic;
+	size_t p = 0;
+
+	if (data == NULL || desc == NULL || size < QOI_HEADER_SIZE) {
+		return 0;
+	}
+
+	header_magic = qoi_read_32(bytes, &p);
+	desc->width = qoi_read_32(bytes, &p);
+	desc->height = qoi_read_32(bytes, &p);
+	desc->channels = bytes[p++];
+	desc->colorspace = bytes[p++];
+
+	return header_magic == QOI_MAGIC && qoi_valid_desc(desc);
+}
+
+int qoi_format_size(int format) {
+	switch (format) {
+		case QOI_FORMAT_RGB: return 3;
+		case QOI_FORMAT_RGB565:
+		case QOI_FORMAT_GRAY16: return 2;
+		case QOI_FORMAT_GRAY: return 1;
+		case QOI_FORMAT_RGBA:
+		case QOI_FORMAT_BGRA:
+		case QOI_FORMAT_ARGB:
+		case QOI_FORMAT_RGBA_PREMUL:
+		case QOI_FORMAT_BGRA_PREMUL:
+		case QOI_FORMAT_RGBX:
+		case QOI_FORMAT_BGRX: return 4;
+		default: return 0;
+	}
+}
+
+/* Bytes per pixel of a valid output format, as a constant expression for the
+decode kernels below */
+#define QOI_FORMAT_BPP(f) \
+	((f) == QOI_FORMAT_RGB ? 3 : (f) == QOI_FORMAT_RGB565 ? 2 : 4)
+
+#define QOI_OUTPUT_FORMAT(f) ((f) >= QOI_FORMAT_RGB && (f) <= QOI_FORMAT_RGB565)
+
+/* v * a / 255, rounded, for v and a in 0..255 */
+#define QOI_PREMUL(v, a) \
+	((((v) * (a) + 128) + (((v) * (a) + 128) >> 8)) >> 8)
+
+/* Convert a pixel to the given output format. The first qoi_format_size()
+bytes of the result, in memory order, are the output pixel. */
+QOI_FORCE_INLINE qoi_rgba_t qoi_convert_px(qoi_rgba_t px, int format) {
+	qoi_rgba_t out;
+	unsigned int a = px.rgba.a;
+	unsigned short v;
+
+	switch (format) {
+		case QOI_FORMAT_BGRA:
+			out.rgba.r = px.rgba.b;
+			out.rgba.g = px.rgba.g;
+			out.rgba.b = px.rgba.r;
+			out.rgba.a = px.rgba.a;
+			return out;
+		case QOI_FORMAT_ARGB:
+			out.rgba.r = px.rgba.a;
+			out.rgba.g = px.rgba.r;
+			out.rgba.b = px.rgba.g;
+			out.rgba.a = px.rgba.b;
+			return out;
+		case QOI_FORMAT_RGBA_PREMUL:
+			out.rgba.r = (unsigned char)QOI_PREMUL(px.rgba.r, a);
+			out.rgba.g = (unsigned char)QOI_PREMUL(px.rgba.g, a);
+			out.rgba.b = (unsigned char)QOI_PREMUL(px.rgba.b, a);
+			out.rgba.a = px.rgba.a;
+			return out;
+		case QOI_FORMAT_BGRA_PREMUL:
+			out.rgba.r = (unsigned char)QOI_PREMUL(px.rgba.b, a);
+			out.rgba.g = (unsigned char)QOI_PREMUL(px.rgba.g, a);
+			out.rgba.b = (unsigned char)QOI_PREMUL(px.rgba.r, a);
+			out.rgba.a = px.rgba.a;
+			return out;
+		case QOI_FORMAT_RGB565:
+			v = (unsigned short)(
+				(px.rgba.r >> 3) << 11 | (px.rgba.g >> 2) << 5 | px.rgba.b >> 3
+			);
+			out.v = 0;
+			memcpy(&out, &v, 2);
+			return out;
+		default:
+			return px;
+	}
+}
+
+/* Store a pixel in the given output format, writing exactly
+qoi_format_size(format) bytes */
+QOI_FORCE_INLINE void qoi_store_px(unsigned char *dst, qoi_rgba_t px, int format) {
+	if (format == QOI_FORMAT_RGB) {
+		memcpy(dst, &px, 3);
+	}
+	else if (format == QOI_FORMAT_RGBA) {
+		memcpy(dst, &px, 4);
+	}
+	else {
+		px = qoi_convert_px(px, format);
+		memcpy(dst, &px, QOI_FORMAT_BPP(format));
+	}
+}
+
+/* Decode px_len bytes of pixels in the given format, one of QOI_FORMAT_*, from
+the chunks starting at bytes[*p_p], continuing from the state in index, px and
+run. QOI_FORMAT_RGB and QOI_FORMAT_RGBA equal 3 and 4, so a number of channels
+may be passed as format. Decoding never reads a chunk that starts at or after
+chunks_len; missing pixels repeat the last pixel instead. */
+static void qoi_decode_span(
+	const unsigned char *bytes, size_t *p_p, size_t chunks_len,
+	qoi_rgba_t *index, qoi_rgba_t *px_p, int *run_p,
+	unsigned char *pixels, size_t px_len, int format
+) {
+	size_t px_pos, p, bpp;
+	qoi_rgba_t px;
+	int run;
+
+	p = *p_p;
+	px = *px_p;
+	run = *run_p;
+	bpp = QOI_FORMAT_BPP(format);
+
+	for (px_pos = 0; px_pos + bpp <= px_len; px_pos += bpp) {
+		if (run > 0) {
+			run--;
+		}
+		else if (p < chunks_len) {
+			int b1 = bytes[p++];
+
+			if (b1 == QOI_OP_RGB) {
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+			}
+			else if (b1 == QOI_OP_RGBA) {
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				px.rgba.a = bytes[p++];
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+				px = index[b1];
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+				px.rgba.r += ((b1 >> 4) & 0x03) - 2;
+				px.rgba.g += ((b1 >> 2) & 0x03) - 2;
+				px.rgba.b += ( b1       & 0x03) - 2;
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+				int b2 = bytes[p++];
+				int vg = (b1 & 0x3f) - 32;
+				px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+				px.rgba.g += vg;
+				px.rgba.b += vg - 8 +  (b2       & 0x0f);
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_RUN) {
+				run = (b1 & 0x3f);
+			}
+
+			index[QOI_COLOR_HASH(px) % 64] = px;
+		}
+
+		if (format == QOI_FORMAT_RGB || format == QOI_FORMAT_RGBA) {
+			pixels[px_pos + 0] = px.rgba.r;
+			pixels[px_pos + 1] = px.rgba.g;
+			pixels[px_pos + 2] = px.rgba.b;
+
+			if (format == QOI_FORMAT_RGBA) {
+				pixels[px_pos + 3] = px.rgba.a;
+			}
+		}
+		else {
+			qoi_store_px(pixels + px_pos, px, format);
+		}
+	}
+
+	*p_p = p;
+	*px_p = px;
+	*run_p = run;
+}
+
+/* The decode kernel below is a faster equivalent of qoi_decode_span(). It
+produces identical pixels for any input, but
+ - has separate code paths for each output format, through qoi_decode_bulk()
+   being inlined with a constant format argument. Converting to the format
+   is thus fused into the store of each pixel
+ - checks bounds once per chunk instead of once per pixel
+ - fills runs with wide stores instead of going through the loop per pixel
+ - keeps the pixel in a single 32 bit word and updates it with word-wide
+   arithmetic, including the index hash
+ - on x86, decodes chains of QOI_OP_DIFF and QOI_OP_LUMA with a vector prefix
+   sum, see qoi_decode_chain_sse2(). The SSE2 or AVX2 variant of the kernel is
+   picked at runtime.
+
+Storing 4 bytes for a 3 channel pixel writes one byte past the pixel, so the
+bulk loop stops one pixel before the end of the output for QOI_FORMAT_RGB. That last pixel, and
+anything after the chunks run out, is handled by qoi_decode_span(). */
+
+QOI_FORCE_INLINE void qoi_decode_fill(unsigned char *pixels, qoi_rgba_t px, size_t n, int format) {
+	int bpp = QOI_FORMAT_BPP(format);
+
+	px = qoi_convert_px(px, format);
+	if (bpp == 2) {
+		for (; n > 0; n--) {
+			memcpy(pixels, &px, 2);
+			pixels += 2;
+		}
+	}
+	else if (bpp == 4) {
+		unsigned char pair[8];
+		memcpy(pair + 0, &px, 4);
+		memcpy(pair + 4, &px, 4);
+		for (; n >= 2; n -= 2) {
+			memcpy(pixels, pair, 8);
+			pixels += 8;
+		}
+		if (n) {
+			memcpy(pixels, &px, 4);
+		}
+	}
+	else {
+		for (; n > 0; n--) {
+			memcpy(pixels, &px, 4);
+			pixels += 3;
+		}
+	}
+}
+
+/* Add the bytes of two 32 bit words without carrying from one byte into the
+next, and per byte deltas for QOI_OP_DIFF, so that the whole pixel is updated
+at once. */
+#define QOI_ADD_BYTES(a, b) \
+	((((a) & 0x7f7f7f7fu) + ((b) & 0x7f7f7f7fu)) ^ (((a) ^ (b)) & 0x80808080u))
+#define QOI_D(i) {{ \
+	(unsigned char)((((i) >> 4) & 3) - 2), \
+	(unsigned char)((((i) >> 2) & 3) - 2), \
+	(unsigned char)(( (i)       & 3) - 2), 0 }}
+#define QOI_D4(i) QOI_D(i), QOI_D(i + 1), QOI_D(i + 2), QOI_D(i + 3)
+#define QOI_D16(i) QOI_D4(i), QOI_D4(i + 4), QOI_D4(i + 8), QOI_D4(i + 12)
+static const qoi_rgba_t qoi_diff_delta[64] = {
+	QOI_D16(0), QOI_D16(16), QOI_D16(32), QOI_D16(48)
+};
+
+#if defined(QOI_SIMD_SSE2)
+
+/* Check whether the op at bytes[p] starts a chain of at least QOI_CHAIN_MIN
+DIFF or LUMA ops. A single op is faster to decode on its own, and looking
+further ahead costs more than it saves. */
+#define QOI_CHAIN_MIN 2
+
+QOI_FORCE_INLINE int qoi_decode_chain_ahead(const unsigned char *bytes, size_t p) {
+	unsigned int b, ok = 1;
+	int i;
+
+	for (i = 0; i < QOI_CHAIN_MIN; i++) {
+		b = bytes[p];
+		ok &= (b - QOI_OP_DIFF) < (QOI_OP_RUN - QOI_OP_DIFF);
+		p += 1 + (b >> 7);
+	}
+	return ok;
+}
+
+/* QOI_OP_DIFF and QOI_OP_LUMA only add a delta to the previous pixel, so the
+pixels of a chain of these ops are a prefix sum over their deltas. Decoding
+them one by one is limited by where each op starts depending on the op before
+it. qoi_decode_chain_sse2() instead works on 16 bytes at once:
+ - every op whose first byte has the high bit set is a QOI_OP_LUMA and
+   consumes the byte after it. The carries of an addition find the bytes
+   consumed this way, much like escaped characters in a string, and thus
+   where each op starts
+ - the chain ends before the first op that is not a DIFF or LUMA
+ - the delta of each byte is computed as if it started a DIFF or LUMA op,
+   and set to zero if it does not start an op of the chain. The channels are
+   kept in separate vectors, one byte per position.
+ - a prefix sum over the positions and the hash of each position are computed
+   with vector instructions
+ - the pixels at the positions where ops start are then written to the index
+   and the output, in order.
+
+The op at bytes[*p_p] must be a DIFF or LUMA. Returns the number of ops
+decoded, between 1 and 16. Reads 17 bytes from bytes and writes up to 64
+bytes to pixels. */
+QOI_FORCE_INLINE int qoi_decode_chain_sse2(
+	const unsigned char *bytes, size_t *p_p,
+	qoi_rgba_t *index, qoi_rgba_t *px_p, unsigned char *pixels, int format
+) {
+	const __m128i mask_lo2 = _mm_set1_epi8(0x03);
+	const __m128i mask_lo4 = _mm_set1_epi8(0x0f);
+	const __m128i bias = _mm_set1_epi8(2);
+	const __m128i bit = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	size_t p = *p_p;
+	__m128i b1 = _mm_loadu_si128((const __m128i *)(bytes + p));
+	__m128i b2 = _mm_loadu_si128((const __m128i *)(bytes + p + 1));
+	__m128i is_luma, is_op, vg, r, g, b, a, h, t, rg, ba;
+	unsigned char px[64], hash[16];
+	qoi_rgba_t c;
+	unsigned int hi, ok, first, consumed, ops, bad, i = 0;
+	int n = 0;
+
+	hi = (unsigned int)_mm_movemask_epi8(b1);
+	ok = ~(unsigned int)_mm_movemask_epi8(_mm_sub_epi8(b1, _mm_set1_epi8(QOI_OP_DIFF)));
+	first = hi & ~(hi << 1);
+	consumed =
+		((hi ^ (hi + (first & 0x5555))) & 0xaaaa) |
+		((hi ^ (hi + (first & 0xaaaa))) & 0x5555);
+	ops = ~consumed & 0xffff;
+	bad = ops & ~ok;
+	ops &= (bad & (0u - bad)) - 1;
+
+	is_op = _mm_and_si128(_mm_unpacklo_epi64(
+		_mm_set1_epi8((char)(ops & 0xff)), _mm_set1_epi8((char)(ops >> 8))
+	), bit);
+	is_op = _mm_cmpeq_epi8(is_op, bit);
+	is_luma = _mm_cmplt_epi8(b1, _mm_setzero_si128());
+
+	/* Deltas, selected between DIFF and LUMA without a branch */
+	vg = _mm_sub_epi8(_mm_and_si128(b1, _mm_set1_epi8(0x3f)), _mm_set1_epi8(32));
+	r = _mm_add_epi8(_mm_sub_epi8(vg, _mm_set1_epi8(8)), _mm_and_si128(_mm_srli_epi16(b2, 4), mask_lo4));
+	b = _mm_add_epi8(_mm_sub_epi8(vg, _mm_set1_epi8(8)), _mm_and_si128(b2, mask_lo4));
+	r = _mm_or_si128(_mm_and_si128(is_luma, r),
+		_mm_andnot_si128(is_luma, _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(b1, 4), mask_lo2), bias)));
+	g = _mm_or_si128(_mm_and_si128(is_luma, vg),
+		_mm_andnot_si128(is_luma, _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(b1, 2), mask_lo2), bias)));
+	b = _mm_or_si128(_mm_and_si128(is_luma, b),
+		_mm_andnot_si128(is_luma, _mm_sub_epi8(_mm_and_si128(b1, mask_lo2), bias)));
+	r = _mm_and_si128(r, is_op);
+	g = _mm_and_si128(g, is_op);
+	b = _mm_and_si128(b, is_op);
+
+	/* Prefix sum, starting from the previous pixel */
+	r = _mm_add_epi8(r, _mm_slli_si128(r, 1));
+	g = _mm_add_epi8(g, _mm_slli_si128(g, 1));
+	b = _mm_add_epi8(b, _mm_slli_si128(b, 1));
+	r = _mm_add_epi8(r, _mm_slli_si128(r, 2));
+	g = _mm_add_epi8(g, _mm_slli_si128(g, 2));
+	b = _mm_add_epi8(b, _mm_slli_si128(b, 2));
+	r = _mm_add_epi8(r, _mm_slli_si128(r, 4));
+	g = _mm_add_epi8(g, _mm_slli_si128(g, 4));
+	b = _mm_add_epi8(b, _mm_slli_si128(b, 4));
+	r = _mm_add_epi8(r, _mm_slli_si128(r, 8));
+	g = _mm_add_epi8(g, _mm_slli_si128(g, 8));
+	b = _mm_add_epi8(b, _mm_slli_si128(b, 8));
+	r = _mm_add_epi8(r, _mm_set1_epi8((char)px_p->rgba.r));
+	g = _mm_add_epi8(g, _mm_set1_epi8((char)px_p->rgba.g));
+	b = _mm_add_epi8(b, _mm_set1_epi8((char)px_p->rgba.b));
+	a = _mm_set1_epi8((char)px_p->rgba.a);
+
+	/* r * 3 + g * 5 + b * 7 + a * 11, modulo 64 */
+	h = _mm_add_epi8(_mm_add_epi8(r, r), r);
+	t = _mm_add_epi8(g, g);
+	h = _mm_add_epi8(h, _mm_add_epi8(_mm_add_epi8(t, t), g));
+	t = _mm_add_epi8(b, b);
+	t = _mm_add_epi8(t, t);
+	h = _mm_add_epi8(h, _mm_sub_epi8(_mm_add_epi8(t, t), b));
+	h = _mm_add_epi8(h, _mm_set1_epi8((char)(px_p->rgba.a * 11)));
+	_mm_storeu_si128((__m128i *)hash, _mm_and_si128(h, _mm_set1_epi8(0x3f)));
+
+	rg = _mm_unpacklo_epi8(r, g);
+	ba = _mm_unpacklo_epi8(b, a);
+	_mm_storeu_si128((__m128i *)(px +  0), _mm_unpacklo_epi16(rg, ba));
+	_mm_storeu_si128((__m128i *)(px + 16), _mm_unpackhi_epi16(rg, ba));
+	rg = _mm_unpackhi_epi8(r, g);
+	ba = _mm_unpackhi_epi8(b, a);
+	_mm_storeu_si128((__m128i *)(px + 32), _mm_unpacklo_epi16(rg, ba));
+	_mm_storeu_si128((__m128i *)(px + 48), _mm_unpackhi_epi16(rg, ba));
+
+	while (ops) {
+		i = (unsigned int)qoi_ctz(ops);
+		memcpy(index + hash[i], px + i * 4, 4);
+		if (format == QOI_FORMAT_RGB || format == QOI_FORMAT_RGBA) {
+			memcpy(pixels + n * format, px + i * 4, 4);
+		}
+		else {
+			memcpy(&c, px + i * 4, 4);
+			qoi_store_px(pixels + n * QOI_FORMAT_BPP(format), c, format);
+		}
+		n++;
+		ops &= ops - 1;
+	}
+
+	memcpy(px_p, px + i * 4, 4);
+	*p_p = p + i + 1 + (bytes[p + i] >> 7);
+	return n;
+}
+
+#endif /* QOI_SIMD_SSE2 */
+
+QOI_FORCE_INLINE void qoi_decode_bulk(
+	const unsigned char *bytes, size_t *p_p, size_t chunks_len,
+	qoi_rgba_t *index, qoi_rgba_t *px_p, int *run_p,
+	unsigned char *pixels, size_t *px_pos_p, size_t px_len, int format, int isa
+) {
+	const int channels = QOI_FORMAT_BPP(format);
+	size_t p = *p_p;
+	size_t px_pos = *px_pos_p;
+	size_t px_bulk = channels != 3 ? px_len - px_len % channels : (px_len >= 3 ? px_len - 3 : 0);
+	qoi_rgba_t px = *px_p;
+	int run = *run_p;
+
+	/* Finish a run left over from the previous span */
+	if (run > 0 && px_pos < px_bulk) {
+		size_t room = (px_bulk - px_pos + channels - 1) / channels;
+		size_t n = (size_t)run < room ? (size_t)run : room;
+		qoi_decode_fill(pixels + px_pos, px, n, format);
+		px_pos += n * channels;
+		run -= (int)n;
+	}
+
+	while (run == 0 && px_pos < px_bulk && p < chunks_len) {
+		int b1 = bytes[p++];
+
+	#if defined(QOI_SIMD_SSE2)
+		if (
+			isa != QOI_ISA_SCALAR &&
+			b1 >= QOI_OP_DIFF && b1 < QOI_OP_RUN &&
+			chunks_len - p >= 16 && px_bulk - px_pos >= 64 &&
+			qoi_decode_chain_ahead(bytes, p - 1)
+		) {
+			int n;
+			p--;
+			n = qoi_decode_chain_sse2(bytes, &p, index, &px, pixels + px_pos, format);
+			px_pos += n * channels;
+			continue;
+		}
+	#else
+		(void)isa;
+	#endif
+
+		if (b1 < 0x40) {
+			px = index[b1];
+		}
+		else if (b1 < 0xc0) {
+			/* QOI_OP_DIFF or QOI_OP_LUMA. These tend to alternate unpredictably,
+			so both deltas are computed and one is selected without a branch.
+			For a DIFF, b2 may be the first byte of the padding. */
+			int b2 = bytes[p];
+			int vg = (b1 & 0x3f) - 32;
+			unsigned int is_luma = (unsigned int)b1 >> 7;
+			unsigned int mask = 0u - is_luma;
+			qoi_rgba_t d;
+			d.rgba.r = vg - 8 + ((b2 >> 4) & 0x0f);
+			d.rgba.g = vg;
+			d.rgba.b = vg - 8 +  (b2       & 0x0f);
+			d.rgba.a = 0;
+			px.v = QOI_ADD_BYTES(px.v, (d.v & mask) | (qoi_diff_delta[b1 & 0x3f].v & ~mask));
+			p += is_luma;
+		}
+		else if (b1 < QOI_OP_RGB) {
+			size_t room = (px_bulk - px_pos + channels - 1) / channels;
+			size_t n = (size_t)(b1 & 0x3f) + 1;
+			if (n > room) {
+				run = (int)(n - room);
+				n = room;
+			}
+			index[QOI_HASH(px)] = px;
+			qoi_decode_fill(pixels + px_pos, px, n, format);
+			px_pos += n * channels;
+			continue;
+		}
+		else if (b1 == QOI_OP_RGB) {
+			px.rgba.r = bytes[p++];
+			px.rgba.g = bytes[p++];
+			px.rgba.b = bytes[p++];
+		}
+		else {
+			memcpy(&px, bytes + p, 4);
+			p += 4;
+		}
+
+		index[QOI_HASH(px)] = px;
+		if (format == QOI_FORMAT_RGB) {
+			memcpy(pixels + px_pos, &px, 4);
+		}
+		else {
+			qoi_store_px(pixels + px_pos, px, format);
+		}
+		px_pos += channels;
+	}
+
+	*p_p = p;
+	*px_p = px;
+	*run_p = run;
+	*px_pos_p = px_pos;
+}
+
+QOI_FORCE_INLINE void qoi_decode_span_isa(
+	const unsigned char *bytes, size_t *p_p, size_t chunks_len,
+	qoi_rgba_t *index, qoi_rgba_t *px_p, int *run_p,
+	unsigned char *pixels, size_t px_len, int format, int isa
+) {
+	size_t px_pos = 0;
+
+	#define QOI_DECODE_BULK(f) \
+		qoi_decode_bulk(bytes, p_p, chunks_len, index, px_p, run_p, pixels, &px_pos, px_len, f, isa)
+	switch (format) {
+		case QOI_FORMAT_RGBA: QOI_DECODE_BULK(QOI_FORMAT_RGBA); break;
+		case QOI_FORMAT_RGB: QOI_DECODE_BULK(QOI_FORMAT_RGB); break;
+		case QOI_FORMAT_BGRA: QOI_DECODE_BULK(QOI_FORMAT_BGRA); break;
+		case QOI_FORMAT_ARGB: QOI_DECODE_BULK(QOI_FORMAT_ARGB); break;
+		case QOI_FORMAT_RGBA_PREMUL: QOI_DECODE_BULK(QOI_FORMAT_RGBA_PREMUL); break;
+		case QOI_FORMAT_BGRA_PREMUL: QOI_DECODE_BULK(QOI_FORMAT_BGRA_PREMUL); break;
+		case QOI_FORMAT_RGB565: QOI_DECODE_BULK(QOI_FORMAT_RGB565); break;
+	}
+	#undef QOI_DECODE_BULK
+
+	qoi_decode_span(
+		bytes, p_p, chunks_len, index, px_p, run_p,
+		pixels + px_pos, px_len - px_pos, format
+	);
+}
+
+#if defined(QOI_SIMD_SSE2)
+static void qoi_decode_span_sse2(
+	const unsigned char *bytes, size_t *p_p, size_t chunks_len,
+	qoi_rgba_t *index, qoi_rgba_t *px_p, int *run_p,
+	unsigned char *pixels, size_t px_len, int format
+) {
+	qoi_decode_span_isa(bytes, p_p, chunks_len, index, px_p, run_p, pixels, px_len, format, QOI_ISA_SSE2);
+}
+#endif
+
+#if defined(QOI_SIMD_AVX2)
+static QOI_TARGET_AVX2 void qoi_decode_span_avx2(
+	const unsigned char *bytes, size_t *p_p, size_t chunks_len,
+	qoi_rgba_t *index, qoi_rgba_t *px_p, int *run_p,
+	unsigned char *pixels, size_t px_len, int format
+) {
+	qoi_decode_span_isa(bytes, p_p, chunks_len, index, px_p, run_p, pixels, px_len, format, QOI_ISA_AVX2);
+}
+#endif
+
+static void qoi_decode_span_fast(
+	const unsigned char *bytes, size_t *p_p, size_t chunks_len,
+	qoi_rgba_t *index, qoi_rgba_t *px_p, int *run_p,
+	unsigned char *pixels, size_t px_len, int format
+) {
+#if defined(QOI_SIMD_AVX2)
+	if (qoi_cpu_isa() >= QOI_ISA_AVX2) {
+		qoi_decode_span_avx2(bytes, p_p, chunks_len, index, px_p, run_p, pixels, px_len, format);
+		return;
+	}
+#endif
+#if defined(QOI_SIMD_SSE2)
+	qoi_decode_span_sse2(bytes, p_p, chunks_len, index, px_p, run_p, pixels, px_len, format);
+#else
+	qoi_decode_span_isa(bytes, p_p, chunks_len, index, px_p, run_p, pixels, px_len, format, QOI_ISA_SCALAR);
+#endif
+}
+
+int qoi_decode_rect(
+	const void *data, size_t size, qoi_desc *desc,
+	void *pixels, ptrdiff_t stride, unsigned int x, unsigned int y, int channels
+) {
+	const unsigned char *bytes;
+	unsigned char *dst;
+	qoi_rgba_t index[64];
+	qoi_rgba_t px;
+	size_t p, row_len, chunks_len;
+	unsigned int row;
+	int run;
+
+	if (
+		pixels == NULL ||
+		(channels != 0 && !QOI_OUTPUT_FORMAT(channels)) ||
+		size < QOI_HEADER_SIZE + sizeof(qoi_padding) ||
+		!qoi_read_header(data, size, desc)
+	) {
+		return 0;
+	}
+
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	bytes = (const unsigned char *)data;
+	row_len = (size_t)desc->width * qoi_format_size(channels);
+	dst = (unsigned char *)pixels + (ptrdiff_t)y * stride + (size_t)x * qoi_format_size(channels);
+	chunks_len = size - sizeof(qoi_padding);
+
+	QOI_ZEROARR(index);
+	qoi_init_state(&px, &run);
+	p = QOI_HEADER_SIZE;
+
+	if (stride == (ptrdiff_t)row_len) {
+		qoi_decode_span_fast(
+			bytes, &p, chunks_len, index, &px, &run,
+			dst, row_len * desc->height, channels
+		);
+	}
+	else {
+		for (row = 0; row < desc->height; row++) {
+			qoi_decode_span_fast(
+				bytes, &p, chunks_len, index, &px, &run,
+				dst, row_len, channels
+			);
+			dst += stride;
+		}
+	}
+	return 1;
+}
+
+/* Check desc against the size in bytes of the complete image and compute the
+size of its pixels in channels (0 or a QOI_FORMAT_*) into px_len. This fails
+for images with more than max_pixels pixels and for images with more pixels
+than their chunks could cover: one byte, a QOI_OP_RUN, covers at most 62
+pixels. Thus a forged header can not cause a huge allocation. */
+static int qoi_check_image_size(
+	const qoi_desc *desc, size_t size, int channels,
+	unsigned long long max_pixels, size_t *px_len
+) {
+	unsigned long long px_count = (unsigned long long)desc->width * desc->height;
+
+	if (
+		size < QOI_HEADER_SIZE + sizeof(qoi_padding) ||
+		px_count > max_pixels ||
+		(px_count + 61) / 62 > size - QOI_HEADER_SIZE - sizeof(qoi_padding)
+	) {
+		return 0;
+	}
+
+	return
+		qoi_size_mad(desc->width, desc->height, 0, px_len) &&
+		qoi_size_mad(*px_len, qoi_format_size(channels ? channels : desc->channels), 0, px_len);
+}
+
+/* Read the header of the complete image of size bytes at data into desc and
+check it with qoi_check_image_size() */
+static int qoi_decode_header(
+	const void *data, size_t size, qoi_desc *desc, int channels,
+	unsigned long long max_pixels, size_t *px_len
+) {
+	return
+		size >= QOI_HEADER_SIZE &&
+		qoi_read_header(data, size, desc) &&
+		qoi_check_image_size(desc, size, channels, max_pixels, px_len);
+}
+
+int qoi_decode_into(const void *data, size_t size, qoi_desc *desc, void *pixels, size_t pixels_size, int channels) {
+	size_t px_len;
+
+	if (
+		(channels != 0 && !QOI_OUTPUT_FORMAT(channels)) ||
+		!qoi_decode_header(data, size, desc, channels, ~0ull, &px_len) ||
+		px_len > pixels_size
+	) {
+		return 0;
+	}
+
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	return qoi_decode_rect(
+		data, size, desc, pixels,
+		(ptrdiff_t)desc->width * qoi_format_size(channels), 0, 0, channels
+	);
+}
+
+static int qoi_decode_parallel_into(
+	qoi_ctx *ctx, const void *data, size_t size, const qoi_desc *desc,
+	unsigned char *pixels, int channels, int nthreads
+);
+
+/* qoi_ctx_decode() for images of up to max_pixels pixels */
+static void *qoi_decode_alloc(
+	qoi_ctx *ctx, const void *data, size_t size, qoi_desc *desc, int channels,
+	int nthreads, unsigned long long max_pixels
+) {
+	unsigned char *pixels;
+	size_t px_len;
+
+	if (
+		(channels != 0 && channels != 3 && channels != 4) ||
+		!qoi_decode_header(data, size, desc, channels, max_pixels, &px_len)
+	) {
+		return NULL;
+	}
+
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	pixels = (unsigned char *) qoi_alloc_out(ctx, px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	if (
+		!qoi_decode_parallel_into(ctx, data, size, desc, pixels, channels, nthreads) &&
+		!qoi_decode_into(data, size, desc, pixels, px_len, channels)
+	) {
+		qoi_free_out(ctx, pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+void *qoi_decode64(const void *data, size_t size, qoi_desc *desc, int channels) {
+	return qoi_decode_alloc(NULL, data, size, desc, channels, 1, ~0ull);
+}
+
+void *qoi_decode(const void *data, int size, qoi_desc *desc, int channels) {
+	if (size < 0) {
+		return NULL;
+	}
+	return qoi_decode_alloc(NULL, data, (size_t)size, desc, channels, 1, QOI_PIXELS_MAX);
+}
+
+enum {
+	QOI_DECODER_STATE_HEADER,
+	QOI_DECODER_STATE_CHUNKS,
+	QOI_DECODER_STATE_PADDING,
+	QOI_DECODER_STATE_DONE,
+	QOI_DECODER_STATE_ERROR
+};
+
+static int qoi_op_size(int b1) {
+	if (b1 == QOI_OP_RGB) {
+		return 4;
+	}
+	else if (b1 == QOI_OP_RGBA) {
+		return 5;
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+		return 2;
+	}
+	return 1;
+}
+
+/* Decode the complete chunk at bytes into px and run and update the index */
+static void qoi_decode_op(const unsigned char *bytes, qoi_rgba_t *index, qoi_rgba_t *px, int *run) {
+	int b1 = bytes[0];
+
+	if (b1 == QOI_OP_RGB) {
+		px->rgba.r = bytes[1];
+		px->rgba.g = bytes[2];
+		px->rgba.b = bytes[3];
+	}
+	else if (b1 == QOI_OP_RGBA) {
+		px->rgba.r = bytes[1];
+		px->rgba.g = bytes[2];
+		px->rgba.b = bytes[3];
+		px->rgba.a = bytes[4];
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+		*px = index[b1];
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+		px->rgba.r += ((b1 >> 4) & 0x03) - 2;
+		px->rgba.g += ((b1 >> 2) & 0x03) - 2;
+		px->rgba.b += ( b1       & 0x03) - 2;
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+		int b2 = bytes[1];
+		int vg = (b1 & 0x3f) - 32;
+		px->rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+		px->rgba.g += vg;
+		px->rgba.b += vg - 8 +  (b2       & 0x0f);
+	}
+	else if ((b1 & QOI_MASK_2) == QOI_OP_RUN) {
+		*run = (b1 & 0x3f);
+	}
+
+	index[QOI_COLOR_HASH((*px)) % 64] = *px;
+}
+
+/* Advance the state like qoi_decode_span() over px_count pixels, but without
+writing them anywhere */
+static void qoi_skip_span(
+	const unsigned char *bytes, size_t *p_p, size_t chunks_len,
+	qoi_rgba_t *index, qoi_rgba_t *px_p, int *run_p, size_t px_count
+) {
+	size_t p = *p_p;
+	int run = *run_p;
+
+	while (px_count > 0) {
+		if (run > 0) {
+			size_t n = (size_t)run < px_count ? (size_t)run : px_count;
+			run -= (int)n;
+			px_count -= n;
+		}
+		else if (p < chunks_len) {
+			int op_size = qoi_op_size(bytes[p]);
+			qoi_decode_op(bytes + p, index, px_p, &run);
+			p += op_size;
+			px_count--;
+		}
+		else {
+			break;
+		}
+	}
+
+	*p_p = p;
+	*run_p = run;
+}
+
+void qoi_decoder_init(qoi_decoder *dec, int channels) {
+	memset(dec, 0, sizeof(qoi_decoder));
+	dec->channels = channels;
+	dec->px.rgba.a = 255;
+	dec->state = (channels != 0 && channels != 3 && channels != 4)
+		? QOI_DECODER_STATE_ERROR
+		: QOI_DECODER_STATE_HEADER;
+}
+
+void qoi_decoder_set_output(qoi_decoder *dec, void *row, size_t row_size, qoi_row_fn row_fn, void *user) {
+	dec->row = (unsigned char *)row;
+	dec->row_size = row_size;
+	dec->row_fn = row_fn;
+	dec->user = user;
+}
+
+/* Move up to want - pending_len bytes from data into the pending buffer.
+Returns 1 if the pending buffer is complete. */
+static int qoi_decoder_fill(qoi_decoder *dec, int want, const unsigned char *bytes, size_t size, size_t *p) {
+	while (dec->pending_len < want && *p < size) {
+		dec->pending[dec->pending_len++] = bytes[(*p)++];
+	}
+	return dec->pending_len == want;
+}
+
+int qoi_decoder_push(qoi_decoder *dec, const void *data, size_t size, size_t *consumed) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	size_t p = 0;
+	int status = QOI_DECODER_NEED_MORE;
+
+	if (dec->state == QOI_DECODER_STATE_HEADER) {
+		unsigned int header_magic;
+		size_t hp = 0;
+
+		if (!qoi_decoder_fill(dec, QOI_HEADER_SIZE, bytes, size, &p)) {
+			*consumed = p;
+			return QOI_DECODER_NEED_MORE;
+		}
+
+		header_magic = qoi_read_32(dec->pending, &hp);
+		dec->desc.width = qoi_read_32(dec->pending, &hp);
+		dec->desc.height = qoi_read_32(dec->pending, &hp);
+		dec->desc.channels = dec->pending[hp++];
+		dec->desc.colorspace = dec->pending[hp++];
+		dec->pending_len = 0;
+
+		if (!qoi_valid_desc(&dec->desc) || header_magic != QOI_MAGIC) {
+			dec->state = QOI_DECODER_STATE_ERROR;
+			*consumed = p;
+			return QOI_DECODER_ERROR;
+		}
+
+		if (dec->channels == 0) {
+			dec->channels = dec->desc.channels;
+		}
+		dec->state = QOI_DECODER_STATE_CHUNKS;
+		*consumed = p;
+		return QOI_DECODER_HEADER;
+	}
+
+	if (dec->state == QOI_DECODER_STATE_CHUNKS) {
+		int channels = dec->channels;
+		unsigned char *row = dec->row;
+		qoi_rgba_t px = dec->px;
+		int run = dec->run;
+		unsigned int x = dec->x;
+
+		if (row == NULL || dec->desc.width > dec->row_size / channels) {
+			dec->state = QOI_DECODER_STATE_ERROR;
+			*consumed = p;
+			return QOI_DECODER_ERROR;
+		}
+
+		while (dec->y < dec->desc.height) {
+			if (run > 0) {
+				run--;
+			}
+			else if (dec->pending_len > 0) {
+				/* Complete a chunk that was split between two pushes */
+				if (!qoi_decoder_fill(dec, qoi_op_size(dec->pending[0]), bytes, size, &p)) {
+					break;
+				}
+				qoi_decode_op(dec->pending, dec->index, &px, &run);
+				dec->pending_len = 0;
+			}
+			else if (p < size) {
+				int op_size = qoi_op_size(bytes[p]);
+				if (size - p < (size_t)op_size) {
+					qoi_decoder_fill(dec, op_size, bytes, size, &p);
+					break;
+				}
+				qoi_decode_op(bytes + p, dec->index, &px, &run);
+				p += op_size;
+			}
+			else {
+				break;
+			}
+
+			row[x * channels + 0] = px.rgba.r;
+			row[x * channels + 1] = px.rgba.g;
+			row[x * channels + 2] = px.rgba.b;
+
+			if (channels == 4) {
+				row[x * channels + 3] = px.rgba.a;
+			}
+
+			if (++x == dec->desc.width) {
+				x = 0;
+				dec->y++;
+				if (dec->row_fn == NULL) {
+					status = QOI_DECODER_ROW;
+					break;
+				}
+				if (!dec->row_fn(dec->user, row, dec->y - 1)) {
+					dec->state = QOI_DECODER_STATE_ERROR;
+					status = QOI_DECODER_ERROR;
+					break;
+				}
+			}
+		}
+
+		dec->px = px;
+		dec->run = run;
+		dec->x = x;
+
+		if (status != QOI_DECODER_ERROR && dec->y == dec->desc.height) {
+			dec->state = QOI_DECODER_STATE_PADDING;
+		}
+		if (status != QOI_DECODER_NEED_MORE) {
+			*consumed = p;
+			return status;
+		}
+	}
+
+	if (dec->state == QOI_DECODER_STATE_PADDING) {
+		if (qoi_decoder_fill(dec, (int)sizeof(qoi_padding), bytes, size, &p)) {
+			dec->pending_len = 0;
+			dec->state = QOI_DECODER_STATE_DONE;
+		}
+	}
+
+	*consumed = p;
+	if (dec->state == QOI_DECODER_STATE_DONE) {
+		return QOI_DECODER_DONE;
+	}
+	else if (dec->state == QOI_DECODER_STATE_ERROR) {
+		return QOI_DECODER_ERROR;
+	}
+	return QOI_DECODER_NEED_MORE;
+}
+
+/* The seek index trailer is made up of one entry for every rows_per_entry rows
+after the first, followed by a footer:
+
+struct qoi_seek_entry_t {
+	uint64_t offset;      // offset of the next chunk from the start (BE)
+	uint32_t run;         // pixels left in the current QOI_OP_RUN (BE)
+	uint8_t  px[4];       // r, g, b, a of the previous pixel
+	uint8_t  index[256];  // r, g, b, a of each of the 64 index entries
+};
+
+struct qoi_seek_footer_t {
+	uint32_t rows_per_entry;  // (BE)
+	uint32_t entry_count;     // (height - 1) / rows_per_entry (BE)
+	uint32_t checksum;        // FNV-1a of all entries (BE)
+	char     magic[4];        // magic bytes "qois"
+};
+
+An entry holds the state of the decoder right before the first pixel of row
+(i + 1) * rows_per_entry. */
+
+#define QOI_SEEK_MAGIC \
+	(((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+	 ((unsigned int)'i') <<  8 | ((unsigned int)'s'))
+#define QOI_SEEK_ENTRY_SIZE (8 + 4 + 4 + 64 * 4)
+#define QOI_SEEK_FOOTER_SIZE 16
+
+size_t qoi_seek_index_size(const qoi_desc *desc, unsigned int rows_per_entry) {
+	if (desc == NULL || desc->height == 0 || rows_per_entry == 0) {
+		return 0;
+	}
+	return (size_t)((desc->height - 1) / rows_per_entry) * QOI_SEEK_ENTRY_SIZE + QOI_SEEK_FOOTER_SIZE;
+}
+
+static void qoi_write_px(unsigned char *bytes, size_t *p, qoi_rgba_t px) {
+	bytes[(*p)++] = px.rgba.r;
+	bytes[(*p)++] = px.rgba.g;
+	bytes[(*p)++] = px.rgba.b;
+	bytes[(*p)++] = px.rgba.a;
+}
+
+static qoi_rgba_t qoi_read_px(const unsigned char *bytes, size_t *p) {
+	qoi_rgba_t px;
+	px.rgba.r = bytes[(*p)++];
+	px.rgba.g = bytes[(*p)++];
+	px.rgba.b = bytes[(*p)++];
+	px.rgba.a = bytes[(*p)++];
+	return px;
+}
+
+/* 32 bit FNV-1a hash of the seek index entries */
+static unsigned int qoi_seek_checksum(const unsigned char *bytes, size_t size) {
+	unsigned int hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash & 0xffffffff;
+}
+
+/* Append the seek index to the size bytes of a complete QOI image in bytes,
+by running the decoder over the image without writing any pixels. Returns the
+new size. */
+static size_t qoi_write_seek_index(
+	unsigned char *bytes, size_t size, const qoi_desc *desc, unsigned int rows_per_entry
+) {
+	qoi_rgba_t index[64];
+	qoi_rgba_t px;
+	size_t p, chunks_len, count, start, i, j;
+	int run;
+
+	QOI_ZEROARR(index);
+	qoi_init_state(&px, &run);
+	p = QOI_HEADER_SIZE;
+	chunks_len = size - sizeof(qoi_padding);
+	count = (desc->height - 1) / rows_per_entry;
+	start = size;
+
+	for (i = 0; i < count; i++) {
+		qoi_skip_span(
+			bytes, &p, chunks_len, index, &px, &run,
+			(size_t)rows_per_entry * desc->width
+		);
+		qoi_write_32(bytes, &size, (unsigned int)((unsigned long long)p >> 32));
+		qoi_write_32(bytes, &size, (unsigned int)p);
+		qoi_write_32(bytes, &size, (unsigned int)run);
+		qoi_write_px(bytes, &size, px);
+		for (j = 0; j < 64; j++) {
+			qoi_write_px(bytes, &size, index[j]);
+		}
+	}
+
+	qoi_write_32(bytes, &size, rows_per_entry);
+	qoi_write_32(bytes, &size, (unsigned int)count);
+	qoi_write_32(bytes, &size, qoi_seek_checksum(bytes + start, size - start - 8));
+	qoi_write_32(bytes, &size, QOI_SEEK_MAGIC);
+	return size;
+}
+
+/* Locate the seek index at the end of the data. Returns the offset of the
+first entry, or 0 if there is no valid seek index or its checksum does not
+match. */
+static size_t qoi_find_seek_index(
+	const unsigned char *bytes, size_t size, const qoi_desc *desc, unsigned int *rows_per_entry
+) {
+	size_t p, index_size;
+	unsigned int rows, count, checksum;
+
+	if (size < QOI_HEADER_SIZE + sizeof(qoi_padding) + QOI_SEEK_FOOTER_SIZE) {
+		return 0;
+	}
+
+	p = size - QOI_SEEK_FOOTER_SIZE;
+	rows = qoi_read_32(bytes, &p);
+	count = qoi_read_32(bytes, &p);
+	checksum = qoi_read_32(bytes, &p);
+	if (
+		qoi_read_32(bytes, &p) != QOI_SEEK_MAGIC || rows == 0 ||
+		count != (desc->height - 1) / rows
+	) {
+		return 0;
+	}
+
+	index_size = qoi_seek_index_size(desc, rows);
+	if (size - QOI_HEADER_SIZE - sizeof(qoi_padding) < index_size) {
+		return 0;
+	}
+	p = size - index_size;
+	if (
+		memcmp(bytes + p - sizeof(qoi_padding), qoi_padding, sizeof(qoi_padding)) != 0 ||
+		qoi_seek_checksum(bytes + p, index_size - QOI_SEEK_FOOTER_SIZE) != checksum
+	) {
+		return 0;
+	}
+
+	*rows_per_entry = rows;
+	return p;
+}
+
+/* Load the decoder state from the seek index entry at bytes[e] and return the
+offset of the next chunk */
+static size_t qoi_read_seek_entry(
+	const unsigned char *bytes, size_t e, size_t chunks_len,
+	qoi_rgba_t *index, qoi_rgba_t *px, int *run
+) {
+	unsigned long long offset;
+	int i;
+
+	offset = qoi_read_32(bytes, &e);
+	offset = offset << 32 | qoi_read_32(bytes, &e);
+	*run = (int)(qoi_read_32(bytes, &e) & 0x3f);
+	*px = qoi_read_px(bytes, &e);
+	for (i = 0; i < 64; i++) {
+		index[i] = qoi_read_px(bytes, &e);
+	}
+	return offset < chunks_len ? (size_t)offset : chunks_len;
+}
+
+/* Check that the seek index entry at bytes[e] holds the given decoder state */
+static int qoi_seek_entry_matches(
+	const unsigned char *bytes, size_t e, size_t chunks_len, size_t p,
+	const qoi_rgba_t *index, qoi_rgba_t px, int run
+) {
+	qoi_rgba_t entry_index[64];
+	qoi_rgba_t entry_px;
+	int entry_run, i, ok;
+
+	ok =
+		qoi_read_seek_entry(bytes, e, chunks_len, entry_index, &entry_px, &entry_run) == p &&
+		entry_px.v == px.v && entry_run == run;
+	for (i = 0; i < 64; i++) {
+		ok &= entry_index[i].v == index[i].v;
+	}
+	return ok;
+}
+
+/* Check every entry of the seek index at bytes[index_pos] against the state of
+the decoder at its row, by running the decoder over the image without writing
+any pixels */
+static int qoi_check_seek_index(
+	const unsigned char *bytes, size_t index_pos, const qoi_desc *desc, unsigned int rows_per_entry
+) {
+	qoi_rgba_t index[64];
+	qoi_rgba_t px;
+	size_t p, chunks_len, count, i;
+	int run;
+
+	QOI_ZEROARR(index);
+	qoi_init_state(&px, &run);
+	p = QOI_HEADER_SIZE;
+	chunks_len = index_pos - sizeof(qoi_padding);
+	count = (desc->height - 1) / rows_per_entry;
+
+	for (i = 0; i < count; i++) {
+		qoi_skip_span(
+			bytes, &p, chunks_len, index, &px, &run,
+			(size_t)rows_per_entry * desc->width
+		);
+		if (!qoi_seek_entry_matches(bytes, index_pos + i * QOI_SEEK_ENTRY_SIZE, chunks_len, p, index, px, run)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void *qoi_encode_seekable(
+	const void *data, const qoi_desc *desc, unsigned int rows_per_entry,
+	int nthreads, size_t *out_len
+) {
+	return qoi_ctx_encode_seekable(NULL, data, desc, rows_per_entry, nthreads, out_len);
+}
+
+void *qoi_ctx_encode_seekable(
+	qoi_ctx *ctx, const void *data, const qoi_desc *desc, unsigned int rows_per_entry,
+	int nthreads, size_t *out_len
+) {
+	size_t max_size, index_size, size;
+	unsigned char *bytes;
+
+	max_size = qoi_max_encoded_size(desc);
+	index_size = qoi_seek_index_size(desc, rows_per_entry);
+	if (
+		data == NULL || out_len == NULL || max_size == 0 || index_size == 0 ||
+		max_size + index_size < max_size
+	) {
+		return NULL;
+	}
+
+	bytes = (unsigned char *) qoi_alloc_out(ctx, max_size + index_size);
+	if (!bytes) {
+		return NULL;
+	}
+
+	size = qoi_encode_parallel_into(data, desc, nthreads, bytes, ctx);
+	if (size == 0) {
+		qoi_free_out(ctx, bytes);
+		return NULL;
+	}
+
+	*out_len = qoi_write_seek_index(bytes, size, desc, rows_per_entry);
+	return bytes;
+}
+
+typedef struct {
+	const unsigned char *bytes;
+	size_t chunks_len;
+	size_t index_pos;
+	unsigned int rows_per_entry;
+	qoi_desc desc;
+	unsigned char *pixels;
+	int channels;
+	size_t count;
+	unsigned char *ok;
+} qoi_parallel_decode_t;
+
+static void qoi_decode_stripe(void *user, size_t k) {
+	qoi_parallel_decode_t *job = (qoi_parallel_decode_t *)user;
+	qoi_rgba_t index[64];
+	qoi_rgba_t px;
+	size_t p, row_len;
+	unsigned int row, rows;
+	int run;
+
+	if (k == 0) {
+		QOI_ZEROARR(index);
+		qoi_init_state(&px, &run);
+		p = QOI_HEADER_SIZE;
+	}
+	else {
+		p = qoi_read_seek_entry(
+			job->bytes, job->index_pos + (k - 1) * QOI_SEEK_ENTRY_SIZE,
+			job->chunks_len, index, &px, &run
+		);
+	}
+
+	row = (unsigned int)k * job->rows_per_entry;
+	rows = job->desc.height - row < job->rows_per_entry ? job->desc.height - row : job->rows_per_entry;
+	row_len = (size_t)job->desc.width * job->channels;
+	qoi_decode_span_fast(
+		job->bytes, &p, job->chunks_len, index, &px, &run,
+		job->pixels + row * row_len, rows * row_len, job->channels
+	);
+
+	/* The seek index is not covered by the QOI data itself; the state at the
+	end of the stripe must be the one that the next stripe starts from */
+	job->ok[k] = k + 1 == job->count || qoi_seek_entry_matches(
+		job->bytes, job->index_pos + k * QOI_SEEK_ENTRY_SIZE,
+		job->chunks_len, p, index, px, run
+	);
+}
+
+/* Decode into pixels using the seek index. desc must have been read with
+qoi_read_header() and pixels must hold width * height * channels bytes. Returns
+0, without decoding anything, if there is no seek index or only one thread.
+Also returns 0, with the pixels partly written, if the seek index does not
+match the image; the image must then be decoded without it. */
+static int qoi_decode_parallel_into(
+	qoi_ctx *ctx, const void *data, size_t size, const qoi_desc *desc,
+	unsigned char *pixels, int channels, int nthreads
+) {
+	qoi_parallel_decode_t job;
+	size_t k;
+	int ok = 1;
+
+	job.bytes = (const unsigned char *)data;
+	job.index_pos = qoi_find_seek_index(job.bytes, size, desc, &job.rows_per_entry);
+	if (job.index_pos == 0 || nthreads <= 1 || desc->height <= job.rows_per_entry) {
+		return 0;
+	}
+
+	job.chunks_len = job.index_pos - sizeof(qoi_padding);
+	job.desc = *desc;
+	job.pixels = pixels;
+	job.channels = channels;
+	job.count = (desc->height - 1) / job.rows_per_entry + 1;
+	job.ok = (unsigned char *) qoi_alloc(ctx, job.count);
+	if (!job.ok) {
+		return 0;
+	}
+
+#if defined(QOI_SIMD_SSE2)
+	qoi_cpu_isa();
+#endif
+	qoi_parallel_for(qoi_decode_stripe, &job, job.count, nthreads);
+
+	for (k = 0; k < job.count; k++) {
+		ok &= job.ok[k];
+	}
+	qoi_free(ctx, job.ok, job.count);
+	return ok;
+}
+
+void *qoi_decode_parallel(const void *data, size_t size, qoi_desc *desc, int channels, int nthreads) {
+	return qoi_decode_alloc(NULL, data, size, desc, channels, nthreads, ~0ull);
+}
+
+void *qoi_ctx_decode(qoi_ctx *ctx, const void *data, size_t size, qoi_desc *desc, int channels, int nthreads) {
+	return qoi_decode_alloc(ctx, data, size, desc, channels, nthreads, ~0ull);
+}
+
+int qoi_decode_region(
+	const void *data, size_t size, qoi_desc *desc,
+	unsigned int x, unsigned int y, unsigned int w, unsigned int h,
+	void *pixels, ptrdiff_t stride, int channels
+) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned char *dst;
+	qoi_rgba_t index[64];
+	qoi_rgba_t px;
+	size_t p, index_pos, chunks_len;
+	unsigned int rows_per_entry, row;
+	int run;
+
+	if (
+		pixels == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		size < QOI_HEADER_SIZE + sizeof(qoi_padding) ||
+		!qoi_read_header(data, size, desc) ||
+		x > desc->width || w > desc->width - x ||
+		y > desc->height || h > desc->height - y
+	) {
+		return 0;
+	}
+
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+	if (w == 0 || h == 0) {
+		return 1;
+	}
+
+	QOI_ZEROARR(index);
+	qoi_init_state(&px, &run);
+	p = QOI_HEADER_SIZE;
+	row = 0;
+
+	/* Start from the last seek index entry at or above the first row */
+	index_pos = qoi_find_seek_index(bytes, size, desc, &rows_per_entry);
+	if (index_pos != 0) {
+		chunks_len = index_pos - sizeof(qoi_padding);
+		if (y >= rows_per_entry) {
+			size_t entry = y / rows_per_entry - 1;
+			p = qoi_read_seek_entry(
+				bytes, index_pos + entry * QOI_SEEK_ENTRY_SIZE, chunks_len,
+				index, &px, &run
+			);
+			row = (unsigned int)(entry + 1) * rows_per_entry;
+		}
+	}
+	else {
+		chunks_len = size - sizeof(qoi_padding);
+	}
+
+	qoi_skip_span(
+		bytes, &p, chunks_len, index, &px, &run,
+		(size_t)(y - row) * desc->width + x
+	);
+
+	dst = (unsigned char *)pixels;
+	for (row = 0; row < h; row++) {
+		qoi_decode_span_fast(
+			bytes, &p, chunks_len, index, &px, &run,
+			dst, (size_t)w * channels, channels
+		);
+		if (row + 1 < h) {
+			qoi_skip_span(bytes, &p, chunks_len, index, &px, &run, desc->width - w);
+		}
+		dst += stride;
+	}
+	return 1;
+}
+
+int qoi_probe(const void *data, size_t size, qoi_info *info) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned int rows = 0;
+	size_t end;
+
+	if (
+		info == NULL ||
+		!qoi_read_header(data, size, &info->desc) ||
+		size < QOI_HEADER_SIZE + sizeof(qoi_padding)
+	) {
+		return 0;
+	}
+
+	end = qoi_find_seek_index(bytes, size, &info->desc, &rows);
+	if (end == 0) {
+		end = size;
+		if (memcmp(bytes + end - sizeof(qoi_padding), qoi_padding, sizeof(qoi_padding)) != 0) {
+			return 0;
+		}
+	}
+
+	info->size = end;
+	info->seek_rows = rows;
+	return 1;
+}
+
+/* Number of bytes and pixels of the op starting with the byte b1 */
+#define QOI_OP_LEN(b1) \
+	(1 + ((b1) >> 6 == 2) + ((b1) == QOI_OP_RGB) * 3 + ((b1) == QOI_OP_RGBA) * 4)
+#define QOI_OP_PIXELS(b1) \
+	((b1) >= QOI_OP_RUN && (b1) < QOI_OP_RGB ? ((b1) & 0x3f) + 1 : 1)
+
+#if defined(QOI_SIMD_SSE2)
+
+/* Walk the ops 16 bytes at a time while there are enough bytes and pixels
+left. As in qoi_decode_chain_sse2(), the carries of an addition find the bytes
+consumed by QOI_OP_LUMA and thus where ops start. A QOI_OP_RGB or _RGBA is
+longer than that accounts for, so the window ends at the first one, which is
+then stepped over on its own, followed by up to 64 more ops if the window
+ended early. The pixels of the ops in a window are summed with one psadbw. */
+static void qoi_validate_sse2(
+	const unsigned char *bytes, size_t *p_p, size_t chunks_len,
+	unsigned long long *px_count_p, unsigned long long px_total
+) {
+	const __m128i bit = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	size_t p = *p_p;
+	unsigned long long px_count = *px_count_p;
+
+	while (chunks_len - p >= 16 + 5 + 64 * 5 && px_total - px_count >= (16 + 1 + 64) * 62) {
+		__m128i b = _mm_loadu_si128((const __m128i *)(bytes + p));
+		__m128i is_op, is_run, px;
+		unsigned int hi, b6, luma, long_op, first, consumed, ops, bad, len;
+		int i;
+
+		hi = (unsigned int)_mm_movemask_epi8(b);
+		b6 = (unsigned int)_mm_movemask_epi8(_mm_add_epi8(b, b));
+		luma = hi & ~b6;
+		long_op = (unsigned int)_mm_movemask_epi8(
+			_mm_cmpeq_epi8(_mm_max_epu8(b, _mm_set1_epi8((char)QOI_OP_RGB)), b)
+		);
+
+		first = luma & ~(luma << 1);
+		consumed =
+			((luma ^ (luma + (first & 0x5555))) & 0xaaaa) |
+			((luma ^ (luma + (first & 0xaaaa))) & 0x5555);
+		ops = ~consumed & 0xffff;
+		bad = ops & long_op;
+		len = 16 + ((ops & luma) >> 15);
+		if (bad) {
+			len = (unsigned int)qoi_ctz(bad);
+			ops &= (bad & (0u - bad)) - 1;
+		}
+
+		/* Each op is one pixel, or (b & 0x3f) + 1 for a QOI_OP_RUN */
+		is_op = _mm_and_si128(_mm_unpacklo_epi64(
+			_mm_set1_epi8((char)(ops & 0xff)), _mm_set1_epi8((char)(ops >> 8))
+		), bit);
+		is_op = _mm_cmpeq_epi8(is_op, bit);
+		is_run = _mm_and_si128(
+			_mm_cmpeq_epi8(_mm_and_si128(b, _mm_set1_epi8((char)0xc0)), _mm_set1_epi8((char)0xc0)),
+			_mm_cmplt_epi8(b, _mm_set1_epi8((char)QOI_OP_RGB))
+		);
+		px = _mm_add_epi8(_mm_set1_epi8(1), _mm_and_si128(is_run, _mm_and_si128(b, _mm_set1_epi8(0x3f))));
+		px = _mm_sad_epu8(_mm_and_si128(px, is_op), _mm_setzero_si128());
+		px_count +=
+			(unsigned int)_mm_cvtsi128_si32(px) +
+			(unsigned int)_mm_cvtsi128_si32(_mm_unpackhi_epi64(px, px));
+		p += len;
+
+		if (bad) {
+			p += QOI_OP_LEN(bytes[p]);
+			px_count++;
+
+			/* Where long ops are frequent, windows end early; stepping over
+			some ops one by one is faster then */
+			for (i = 0; len < 8 && i < 64; i++) {
+				int b1 = bytes[p];
+				p += QOI_OP_LEN(b1);
+				px_count += QOI_OP_PIXELS(b1);
+			}
+		}
+	}
+
+	*p_p = p;
+	*px_count_p = px_count;
+}
+
+#endif /* QOI_SIMD_SSE2 */
+
+int qoi_validate(const void *data, size_t size, qoi_info *info) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned long long px_count, px_total;
+	size_t p, chunks_len;
+	int b1;
+
+	if (!qoi_probe(data, size, info)) {
+		return 0;
+	}
+
+	px_total = (unsigned long long)info->desc.width * info->desc.height;
+	chunks_len = info->size - sizeof(qoi_padding);
+	px_count = 0;
+	p = QOI_HEADER_SIZE;
+
+#if defined(QOI_SIMD_SSE2)
+	qoi_validate_sse2(bytes, &p, chunks_len, &px_count, px_total);
+#endif
+
+	while (p < chunks_len && px_count < px_total) {
+		b1 = bytes[p];
+		if ((size_t)QOI_OP_LEN(b1) > chunks_len - p) {
+			return 0;
+		}
+		p += QOI_OP_LEN(b1);
+		px_count += QOI_OP_PIXELS(b1);
+	}
+
+	/* The ops must end exactly at the end marker and with the last pixel; a
+	run must not extend past the image */
+	if (p != chunks_len || px_count != px_total) {
+		return 0;
+	}
+
+	/* The seek index is not covered by the ops; decoders that start from an
+	entry rely on it holding the state at its row */
+	return info->seek_rows == 0 || qoi_check_seek_index(bytes, info->size, &info->desc, info->seek_rows);
+}
+
+#ifdef QOI_STATS
+
+static void qoi_stats_add_run(qoi_stats *stats, unsigned long long run) {
+	int k = 0;
+	while (run >>= 1) {
+		k++;
+	}
+	stats->runs[k < QOI_STATS_RUN_BUCKETS ? k : QOI_STATS_RUN_BUCKETS - 1]++;
+}
+
+int qoi_stats_collect(const void *data, size_t size, qoi_stats *stats) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	qoi_rgba_t index[64], enc_index[64], evicted[64], px;
+	unsigned long long occupied = 0, has_evicted = 0, run_len = 0;
+	qoi_info info;
+	size_t p, chunks_len;
+	int b1, op, run, pos;
+
+	/* After this, the ops are known to lie within the data */
+	if (stats == NULL || !qoi_validate(data, size, &info)) {
+		return 0;
+	}
+
+	chunks_len = info.size - sizeof(qoi_padding);
+	QOI_ZEROARR(index);
+	QOI_ZEROARR(enc_index);
+	px.v = 0;
+	px.rgba.a = 255;
+
+	for (p = QOI_HEADER_SIZE; p < chunks_len; p += qoi_op_size(b1)) {
+		b1 = bytes[p];
+		qoi_decode_op(bytes + p, index, &px, &run);
+
+		op =
+			b1 == QOI_OP_RGBA ? QOI_STATS_RGBA :
+			b1 == QOI_OP_RGB ? QOI_STATS_RGB :
+			b1 >> 6;
+		stats->ops[op]++;
+		stats->bytes[op] += qoi_op_size(b1);
+
+		if (op == QOI_STATS_RUN) {
+			run_len += (b1 & 0x3f) + 1;
+			continue;
+		}
+		if (run_len) {
+			qoi_stats_add_run(stats, run_len);
+			run_len = 0;
+		}
+
+		/* Replay the encoder's index, which unlike the decoder's is not
+		updated by runs */
+		stats->index_lookups++;
+		pos = QOI_COLOR_HASH(px) % 64;
+		if (op == QOI_STATS_INDEX) {
+			stats->index_hits++;
+		}
+		else {
+			if (has_evicted >> pos & 1 && evicted[pos].v == px.v) {
+				stats->hash_collisions++;
+			}
+			if (occupied >> pos & 1) {
+				evicted[pos] = enc_index[pos];
+				has_evicted |= 1ull << pos;
+			}
+			occupied |= 1ull << pos;
+		}
+		enc_index[pos] = px;
+	}
+	if (run_len) {
+		qoi_stats_add_run(stats, run_len);
+	}
+
+	stats->images++;
+	stats->pixels += (unsigned long long)info.desc.width * info.desc.height;
+	return 1;
+}
+
+#endif /* QOI_STATS */
+
+typedef struct {
+	qoi_batch_item *items;
+	unsigned char *arena;
+} qoi_batch_t;
+
+static void qoi_encode_batch_item(void *user, size_t i) {
+	qoi_batch_t *batch = (qoi_batch_t *)user;
+	qoi_batch_item *item = &batch->items[i];
+	if (item->len > 0) {
+		item->len = qoi_encode_into(item->data, &item->desc, batch->arena + item->offset, item->len);
+	}
+}
+
+static void qoi_decode_batch_item(void *user, size_t i) {
+	qoi_batch_t *batch = (qoi_batch_t *)user;
+	qoi_batch_item *item = &batch->items[i];
+	if (
+		item->len > 0 &&
+		!qoi_decode_into(
+			item->data, item->size, &item->desc,
+			batch->arena + item->offset, item->len, item->channels
+		)
+	) {
+		item->len = 0;
+	}
+}
+
+/* Allocate the arena and run fn for every item. On entry, len holds the room
+each item needs in the arena, or 0 for items that are invalid. */
+static void *qoi_run_batch(
+	qoi_ctx *ctx, qoi_batch_item *items, size_t count, int nthreads,
+	size_t *arena_size, qoi_task_fn fn
+) {
+	qoi_batch_t batch;
+	size_t i, total = 0;
+
+	for (i = 0; i < count; i++) {
+		items[i].offset = total;
+		if (total + items[i].len < total) {
+			return NULL;
+		}
+		total += items[i].len;
+	}
+
+	batch.items = items;
+	batch.arena = (unsigned char *) qoi_alloc_out(ctx, total > 0 ? total : 1);
+	if (!batch.arena) {
+		return NULL;
+	}
+
+#if defined(QOI_SIMD_SSE2)
+	qoi_cpu_isa();
+#endif
+	qoi_parallel_for(fn, &batch, count, nthreads);
+	*arena_size = total;
+	return batch.arena;
+}
+
+void *qoi_encode_batch(qoi_batch_item *items, size_t count, int nthreads, size_t *arena_size) {
+	return qoi_ctx_encode_batch(NULL, items, count, nthreads, arena_size);
+}
+
+void *qoi_ctx_encode_batch(qoi_ctx *ctx, qoi_batch_item *items, size_t count, int nthreads, size_t *arena_size) {
+	size_t i;
+
+	if (items == NULL || arena_size == NULL) {
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		items[i].len = items[i].data != NULL ? qoi_max_encoded_size(&items[i].desc) : 0;
+	}
+	return qoi_run_batch(ctx, items, count, nthreads, arena_size, qoi_encode_batch_item);
+}
+
+void *qoi_decode_batch(qoi_batch_item *items, size_t count, int nthreads, size_t *arena_size) {
+	return qoi_ctx_decode_batch(NULL, items, count, nthreads, arena_size);
+}
+
+void *qoi_ctx_decode_batch(qoi_ctx *ctx, qoi_batch_item *items, size_t count, int nthreads, size_t *arena_size) {
+	size_t i;
+
+	if (items == NULL || arena_size == NULL) {
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		qoi_batch_item *item = &items[i];
+		int channels = item->channels;
+		item->len = 0;
+		if (
+			(channels != 0 && channels != 3 && channels != 4) ||
+			!qoi_decode_header(item->data, item->size, &item->desc, channels, ~0ull, &item->len)
+		) {
+			item->len = 0;
+		}
+	}
+	return qoi_run_batch(ctx, items, count, nthreads, arena_size, qoi_decode_batch_item);
+}
+
+/* -----------------------------------------------------------------------------
+Frame sequences
+
+The sequence starts with a header:
+
+struct qoi_seq_header_t {
+	char     magic[4];     // magic bytes "qoiv"
+	uint32_t width;        // frame width in pixels (BE)
+	uint32_t height;       // frame height in pixels (BE)
+	uint8_t  channels;     // 3 = RGB, 4 = RGBA
+	uint8_t  colorspace;   // as for QOI images
+	uint32_t stripe_rows;  // rows per stripe (BE)
+};
+
+Each frame starts with a kind byte. A key frame is followed by the size of its
+QOI image as uint64_t (BE) and the image. A delta frame is followed by a
+bitmap with one bit per stripe, the first stripe in the most significant bit
+of the first byte, and then the size and QOI image of each stripe whose bit is
+set, in order. A repeated frame has no further data.
+
+After the last frame follows the table, the offset of every frame from the
+start of the sequence as uint64_t (BE), and then the number of frames as
+uint32_t (BE) and the magic bytes "qoiv" again. */
+
+#define QOI_SEQ_MAGIC \
+	(((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+	 ((unsigned int)'i') <<  8 | ((unsigned int)'v'))
+#define QOI_SEQ_HEADER_SIZE 18
+#define QOI_SEQ_FOOTER_SIZE 8
+#define QOI_SEQ_STRIPE_ROWS 16
+
+#define QOI_SEQ_KEY    0
+#define QOI_SEQ_DELTA  1
+#define QOI_SEQ_REPEAT 2
+
+static void qoi_write_64(unsigned char *bytes, size_t *p, unsigned long long v) {
+	qoi_write_32(bytes, p, (unsigned int)(v >> 32));
+	qoi_write_32(bytes, p, (unsigned int)v);
+}
+
+static unsigned long long qoi_read_64(const unsigned char *bytes, size_t *p) {
+	unsigned long long v = qoi_read_32(bytes, p);
+	return v << 32 | qoi_read_32(bytes, p);
+}
+
+static int qoi_seq_write(qoi_seq_encoder *enc, const void *data, size_t size) {
+	if (!enc->error && !enc->write(enc->user, data, size)) {
+		enc->error = 1;
+	}
+	enc->offset += size;
+	return !enc->error;
+}
+
+/* Return the size of the bitmap of changed stripes */
+static size_t qoi_seq_bitmap_size(const qoi_desc *desc, unsigned int stripe_rows) {
+	return ((desc->height - 1) / stripe_rows + 8) / 8;
+}
+
+static void qoi_seq_encoder_free(qoi_seq_encoder *enc) {
+	qoi_free(enc->ctx, enc->table, sizeof(unsigned long long) * enc->table_size);
+	qoi_free(enc->ctx, enc->prev, (size_t)enc->desc.width * enc->desc.height * enc->desc.channels);
+	if (enc->bitmap) {
+		/* stripe_rows is only set once init got past the desc check */
+		qoi_free(enc->ctx, enc->bitmap, qoi_seq_bitmap_size(&enc->desc, enc->stripe_rows));
+	}
+	qoi_free(enc->ctx, enc->buffer, enc->buffer_size);
+	enc->table = NULL;
+	enc->prev = enc->bitmap = enc->buffer = NULL;
+}
+
+int qoi_seq_encoder_init(
+	qoi_seq_encoder *enc, const qoi_desc *desc, unsigned int stripe_rows,
+	unsigned int key_interval, qoi_write_fn write, void *user
+) {
+	return qoi_ctx_seq_encoder_init(NULL, enc, desc, stripe_rows, key_interval, write, user);
+}
+
+int qoi_ctx_seq_encoder_init(
+	qoi_ctx *ctx, qoi_seq_encoder *enc, const qoi_desc *desc, unsigned int stripe_rows,
+	unsigned int key_interval, qoi_write_fn write, void *user
+) {
+	unsigned char header[QOI_SEQ_HEADER_SIZE];
+	size_t frame_size, p = 0;
+
+	if (enc == NULL) {
+		return 0;
+	}
+
+	memset(enc, 0, sizeof(qoi_seq_encoder));
+	enc->error = 1;
+	if (
+		desc == NULL || write == NULL || !qoi_valid_desc(desc) ||
+		!qoi_size_mad(desc->width, desc->height, 0, &frame_size) ||
+		!qoi_size_mad(frame_size, desc->channels, 0, &frame_size)
+	) {
+		return 0;
+	}
+
+	enc->desc = *desc;
+	enc->stripe_rows = stripe_rows ? stripe_rows : QOI_SEQ_STRIPE_ROWS;
+	if (enc->stripe_rows > desc->height) {
+		enc->stripe_rows = desc->height;
+	}
+	enc->key_interval = key_interval;
+	enc->write = write;
+	enc->user = user;
+	enc->ctx = ctx;
+
+	/* A key frame takes more space than any single stripe, so the buffer for a
+	key frame holds every QOI image of a frame */
+	enc->buffer_size = qoi_max_encoded_size(desc);
+	enc->table_size = 64;
+	enc->buffer = (unsigned char *) qoi_alloc(ctx, enc->buffer_size);
+	enc->prev = (unsigned char *) qoi_alloc(ctx, frame_size);
+	enc->bitmap = (unsigned char *) qoi_alloc(ctx, qoi_seq_bitmap_size(desc, enc->stripe_rows));
+	enc->table = (unsigned long long *) qoi_alloc(ctx, sizeof(unsigned long long) * enc->table_size);
+	if (enc->buffer_size == 0 || !enc->buffer || !enc->prev || !enc->bitmap || !enc->table) {
+		qoi_seq_encoder_free(enc);
+		return 0;
+	}
+
+	qoi_write_32(header, &p, QOI_SEQ_MAGIC);
+	qoi_write_32(header, &p, desc->width);
+	qoi_write_32(header, &p, desc->height);
+	header[p++] = desc->channels;
+	header[p++] = desc->colorspace;
+	qoi_write_32(header, &p, enc->stripe_rows);
+
+	enc->error = 0;
+	return qoi_seq_write(enc, header, p);
+}
+
+/* Encode size bytes of pixels as a QOI image of the given height into the
+buffer and write its size and the image */
+static int qoi_seq_write_image(qoi_seq_encoder *enc, const unsigned char *pixels, unsigned int height) {
+	unsigned char len[8];
+	qoi_desc desc = enc->desc;
+	size_t size, p = 0;
+
+	desc.height = height;
+	size = qoi_encode_into(pixels, &desc, enc->buffer, enc->buffer_size);
+	if (size == 0) {
+		enc->error = 1;
+		return 0;
+	}
+	qoi_write_64(len, &p, size);
+	return qoi_seq_write(enc, len, p) && qoi_seq_write(enc, enc->buffer, size);
+}
+
+/* Return the number of rows of stripe s */
+static unsigned int qoi_seq_stripe_rows(const qoi_desc *desc, unsigned int stripe_rows, unsigned int s) {
+	unsigned int y = s * stripe_rows;
+	return desc->height - y < stripe_rows ? desc->height - y : stripe_rows;
+}
+
+int qoi_seq_encoder_push(qoi_seq_encoder *enc, const void *pixels) {
+	const unsigned char *src = (const unsigned char *)pixels;
+	unsigned char kind;
+	unsigned int stripes, changed, s, rows;
+	size_t row_size, stripe_size, offset;
+
+	if (enc == NULL || enc->error) {
+		return 0;
+	}
+	if (pixels == NULL || enc->frames == 0xffffffff) {
+		enc->error = 1;
+		return 0;
+	}
+
+	if (enc->frames == enc->table_size) {
+		unsigned long long *table = (unsigned long long *) qoi_alloc(enc->ctx, sizeof(unsigned long long) * enc->table_size * 2);
+		if (!table) {
+			enc->error = 1;
+			return 0;
+		}
+		memcpy(table, enc->table, sizeof(unsigned long long) * enc->table_size);
+		qoi_free(enc->ctx, enc->table, sizeof(unsigned long long) * enc->table_size);
+		enc->table = table;
+		enc->table_size *= 2;
+	}
+	enc->table[enc->frames] = enc->offset;
+
+	row_size = (size_t)enc->desc.width * enc->desc.channels;
+	stripe_size = row_size * enc->stripe_rows;
+	stripes = (enc->desc.height - 1) / enc->stripe_rows + 1;
+
+	/* Compare each stripe with the previous frame. If all of them changed, a
+	key frame is no larger than a delta frame and decodes faster. */
+	kind = QOI_SEQ_KEY;
+	if (enc->frames > 0 && (enc->key_interval == 0 || enc->frames % enc->key_interval != 0)) {
+		memset(enc->bitmap, 0, (stripes + 7) / 8);
+		changed = 0;
+		for (s = 0; s < stripes; s++) {
+			rows = qoi_seq_stripe_rows(&enc->desc, enc->stripe_rows, s);
+			offset = stripe_size * s;
+			if (memcmp(enc->prev + offset, src + offset, row_size * rows) != 0) {
+				enc->bitmap[s >> 3] |= 0x80 >> (s & 7);
+				changed++;
+			}
+		}
+		if (changed == 0) {
+			kind = QOI_SEQ_REPEAT;
+		}
+		else if (changed < stripes) {
+			kind = QOI_SEQ_DELTA;
+		}
+	}
+
+	if (!qoi_seq_write(enc, &kind, 1)) {
+		return 0;
+	}
+
+	if (kind == QOI_SEQ_KEY) {
+		if (!qoi_seq_write_image(enc, src, enc->desc.height)) {
+			return 0;
+		}
+		memcpy(enc->prev, src, row_size * enc->desc.height);
+	}
+	else if (kind == QOI_SEQ_DELTA) {
+		if (!qoi_seq_write(enc, enc->bitmap, (stripes + 7) / 8)) {
+			return 0;
+		}
+		for (s = 0; s < stripes; s++) {
+			if (enc->bitmap[s >> 3] & (0x80 >> (s & 7))) {
+				rows = qoi_seq_stripe_rows(&enc->desc, enc->stripe_rows, s);
+				offset = stripe_size * s;
+				if (!qoi_seq_write_image(enc, src + offset, rows)) {
+					return 0;
+				}
+				memcpy(enc->prev + offset, src + offset, row_size * rows);
+			}
+		}
+	}
+
+	enc->frames++;
+	return 1;
+}
+
+int qoi_seq_encoder_finish(qoi_seq_encoder *enc) {
+	unsigned char entry[8];
+	unsigned int i;
+	size_t p;
+
+	if (enc == NULL) {
+		return 0;
+	}
+
+	for (i = 0; i < enc->frames && !enc->error; i++) {
+		p = 0;
+		qoi_write_64(entry, &p, enc->table[i]);
+		qoi_seq_write(enc, entry, p);
+	}
+	p = 0;
+	qoi_write_32(entry, &p, enc->frames);
+	qoi_write_32(entry, &p, QOI_SEQ_MAGIC);
+	qoi_seq_write(enc, entry, p);
+
+	qoi_seq_encoder_free(enc);
+	if (enc->error) {
+		return 0;
+	}
+
+	/* The sequence is complete; any further calls fail */
+	enc->error = 1;
+	return 1;
+}
+
+int qoi_seq_open(qoi_seq *seq, const void *data, size_t size) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned long long prev, offset;
+	unsigned int i;
+	size_t p;
+
+	if (
+		seq == NULL || data == NULL ||
+		size < QOI_SEQ_HEADER_SIZE + QOI_SEQ_FOOTER_SIZE
+	) {
+		return 0;
+	}
+
+	p = 0;
+	if (qoi_read_32(bytes, &p) != QOI_SEQ_MAGIC) {
+		return 0;
+	}
+	seq->desc.width = qoi_read_32(bytes, &p);
+	seq->desc.height = qoi_read_32(bytes, &p);
+	seq->desc.channels = bytes[p++];
+	seq->desc.colorspace = bytes[p++];
+	seq->stripe_rows = qoi_read_32(bytes, &p);
+	if (!qoi_valid_desc(&seq->desc) || seq->stripe_rows == 0) {
+		return 0;
+	}
+
+	p = size - QOI_SEQ_FOOTER_SIZE;
+	seq->frames = qoi_read_32(bytes, &p);
+	if (
+		qoi_read_32(bytes, &p) != QOI_SEQ_MAGIC ||
+		seq->frames > (size - QOI_SEQ_HEADER_SIZE - QOI_SEQ_FOOTER_SIZE) / 9
+	) {
+		return 0;
+	}
+
+	/* Every frame takes at least its kind byte, so the offsets in the table
+	must be strictly increasing and lie between the header and the table */
+	seq->bytes = bytes;
+	seq->table = size - QOI_SEQ_FOOTER_SIZE - (size_t)seq->frames * 8;
+	prev = QOI_SEQ_HEADER_SIZE - 1;
+	p = seq->table;
+	for (i = 0; i < seq->frames; i++) {
+		offset = qoi_read_64(bytes, &p);
+		if (offset <= prev || offset >= seq->table) {
+			return 0;
+		}
+		prev = offset;
+	}
+	p = seq->table;
+	return seq->frames == 0 || qoi_read_64(bytes, &p) == QOI_SEQ_HEADER_SIZE;
+}
+
+/* Return the offset of the frame and set end to the offset of the next one */
+static size_t qoi_seq_frame(const qoi_seq *seq, unsigned int frame, size_t *end) {
+	size_t p = seq->table + (size_t)frame * 8;
+	size_t offset = (size_t)qoi_read_64(seq->bytes, &p);
+	*end = frame + 1 < seq->frames ? (size_t)qoi_read_64(seq->bytes, &p) : seq->table;
+	return offset;
+}
+
+unsigned int qoi_seq_key_frame(const qoi_seq *seq, unsigned int frame) {
+	size_t end;
+
+	if (seq == NULL || seq->frames == 0) {
+		return 0;
+	}
+	if (frame >= seq->frames) {
+		frame = seq->frames - 1;
+	}
+	while (frame > 0 && seq->bytes[qoi_seq_frame(seq, frame, &end)] != QOI_SEQ_KEY) {
+		frame--;
+	}
+	return frame;
+}
+
+/* Decode the QOI image at bytes[*p] into pixels, which holds the given number
+of rows */
+static int qoi_seq_read_image(
+	const qoi_seq *seq, size_t *p, size_t end,
+	unsigned char *pixels, unsigned int rows, int channels
+) {
+	unsigned long long len;
+	qoi_desc desc;
+
+	if (end - *p < 8) {
+		return 0;
+	}
+	len = qoi_read_64(seq->bytes, p);
+	if (len > end - *p) {
+		return 0;
+	}
+	if (
+		!qoi_decode_into(
+			seq->bytes + *p, (size_t)len, &desc, pixels,
+			(size_t)seq->desc.width * rows * channels, channels
+		) ||
+		desc.width != seq->desc.width || desc.height != rows
+	) {
+		return 0;
+	}
+	*p += (size_t)len;
+	return 1;
+}
+
+int qoi_seq_decode_frame(const qoi_seq *seq, unsigned int frame, void *pixels, int channels) {
+	unsigned char *dst = (unsigned char *)pixels;
+	unsigned int stripes, s, rows;
+	size_t p, end, bitmap, stripe_size;
+
+	if (
+		seq == NULL || pixels == NULL || frame >= seq->frames ||
+		(channels != 0 && channels != 3 && channels != 4)
+	) {
+		return 0;
+	}
+
+	if (channels == 0) {
+		channels = seq->desc.channels;
+	}
+
+	p = qoi_seq_frame(seq, frame, &end);
+	switch (seq->bytes[p++]) {
+		case QOI_SEQ_KEY:
+			return qoi_seq_read_image(seq, &p, end, dst, seq->desc.height, channels);
+
+		case QOI_SEQ_REPEAT:
+			return 1;
+
+		case QOI_SEQ_DELTA:
+			stripes = (seq->desc.height - 1) / seq->stripe_rows + 1;
+			stripe_size = (size_t)seq->desc.width * channels * seq->stripe_rows;
+			bitmap = p;
+			if (end - p < (stripes + 7) / 8) {
+				return 0;
+			}
+			p += (stripes + 7) / 8;
+			for (s = 0; s < stripes; s++) {
+				if (seq->bytes[bitmap + (s >> 3)] & (0x80 >> (s & 7))) {
+					rows = qoi_seq_stripe_rows(&seq->desc, seq->stripe_rows, s);
+					if (!qoi_seq_read_image(seq, &p, end, dst + stripe_size * s, rows, channels)) {
+						return 0;
+					}
+				}
+			}
+			return 1;
+
+		default:
+			return 0;
+	}
+}
+
+/* -----------------------------------------------------------------------------
+LZ back-end
+
+Packed data starts with a header:
+
+struct qoi_lz_header_t {
+	char     magic[4];    // magic bytes "qoiz"
+	uint32_t block_size;  // bytes per block of the unpacked data (BE)
+	uint64_t size;        // size of the unpacked data (BE)
+};
+
+It is followed by the packed size of every block as uint32_t (BE) and then the
+packed blocks. A block whose packed size equals its unpacked size is stored as
+is. Any other block is a sequence of commands, as in LZ4: a token byte, whose
+upper 4 bits are the number of literals and lower 4 bits the match length
+minus 4; more bytes of the number of literals if it is 15 or more; the
+literals; the offset of the match as uint16_t (LE); and more bytes of the match
+length if it is 15 or more. The more bytes of a length are added to it, with
+each byte of 255 followed by another one. The last command of a block has only
+literals, the last 5 bytes of a block are always literals and no match starts
+in the last 12 bytes. */
+
+#define QOI_LZ_MAGIC \
+	(((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+	 ((unsigned int)'i') <<  8 | ((unsigned int)'z'))
+#define QOI_LZ_HEADER_SIZE 16
+#define QOI_LZ_BLOCK_MAX (1 << 30)
+#define QOI_LZ_HASH_BITS 14
+#define QOI_LZ_MIN_MATCH 4
+#define QOI_LZ_LAST_LITERALS 5
+#define QOI_LZ_MATCH_LIMIT 12
+
+typedef struct {
+	size_t offset;
+	size_t size;
+	int ok;
+} qoi_lz_block_t;
+
+typedef struct {
+	const unsigned char *src;
+	unsigned char *dst;
+	size_t size;
+	size_t block_size;
+	size_t count;
+	size_t first;
+	qoi_lz_block_t *blocks;
+} qoi_lz_job_t;
+
+static unsigned int qoi_lz_read_32(const unsigned char *bytes) {
+	unsigned int v;
+	memcpy(&v, bytes, 4);
+	return v;
+}
+
+/* Write the more bytes of a length, len being the length minus 15 */
+static size_t qoi_lz_write_len(unsigned char *bytes, size_t p, size_t len) {
+	for (; len >= 255; len -= 255) {
+		bytes[p++] = 255;
+	}
+	bytes[p++] = (unsigned char)len;
+	return p;
+}
+
+/* Write a command with len literals from src followed by a match of match_len
+bytes at offset, or no match if match_len is 0 */
+static size_t qoi_lz_write_command(
+	unsigned char *bytes, size_t p, const unsigned char *src, size_t len,
+	size_t offset, size_t match_len
+) {
+	size_t token = p++;
+
+	bytes[token] = (unsigned char)((len < 15 ? len : 15) << 4);
+	if (len >= 15) {
+		p = qoi_lz_write_len(bytes, p, len - 15);
+	}
+	memcpy(bytes + p, src, len);
+	p += len;
+
+	if (match_len > 0) {
+		bytes[p++] = (unsigned char)offset;
+		bytes[p++] = (unsigned char)(offset >> 8);
+		match_len -= QOI_LZ_MIN_MATCH;
+		bytes[token] |= (unsigned char)(match_len < 15 ? match_len : 15);
+		if (match_len >= 15) {
+			p = qoi_lz_write_len(bytes, p, match_len - 15);
+		}
+	}
+	return p;
+}
+
+/* Compress len bytes from src into bytes, which must hold len bytes. Returns
+the packed size, or 0 if the block does not get smaller. Matches are found
+through a hash table of the last position of every 4 byte sequence. Where no
+matches are found, the search speeds up by skipping more and more bytes. */
+static size_t qoi_lz_compress_block(const unsigned char *src, size_t len, unsigned char *bytes) {
+	unsigned int table[1 << QOI_LZ_HASH_BITS];
+	size_t ip = 0, anchor = 0, p = 0, misses = 0;
+
+	if (len > QOI_LZ_MATCH_LIMIT) {
+		QOI_ZEROARR(table);
+		while (ip < len - QOI_LZ_MATCH_LIMIT) {
+			unsigned int v = qoi_lz_read_32(src + ip);
+			unsigned int h = ((v * 2654435761u) & 0xffffffff) >> (32 - QOI_LZ_HASH_BITS);
+			size_t ref = table[h];
+
+			table[h] = (unsigned int)ip;
+			if (ref < ip && ip - ref <= 0xffff && qoi_lz_read_32(src + ref) == v) {
+				size_t end = len - QOI_LZ_LAST_LITERALS;
+				size_t offset = ip - ref;
+				size_t m = ip + QOI_LZ_MIN_MATCH;
+
+				while (m + 4 <= end && qoi_lz_read_32(src + m) == qoi_lz_read_32(src + m - offset)) {
+					m += 4;
+				}
+				while (m < end && src[m] == src[m - offset]) {
+					m++;
+				}
+				while (ip > anchor && ip > offset && src[ip - 1] == src[ip - 1 - offset]) {
+					ip--;
+				}
+
+				if (p + (ip - anchor) + (ip - anchor) / 255 + (m - ip) / 255 + 8 >= len) {
+					return 0;
+				}
+				p = qoi_lz_write_command(bytes, p, src + anchor, ip - anchor, offset, m - ip);
+				ip = anchor = m;
+				misses = 0;
+
+				if (ip < len - QOI_LZ_MATCH_LIMIT) {
+					v = qoi_lz_read_32(src + ip - 2);
+					table[((v * 2654435761u) & 0xffffffff) >> (32 - QOI_LZ_HASH_BITS)] = (unsigned int)(ip - 2);
+				}
+			}
+			else {
+				ip += 1 + (misses++ >> 6);
+			}
+		}
+	}
+
+	if (p + (len - anchor) + (len - anchor) / 255 + 2 >= len) {
+		return 0;
+	}
+	return qoi_lz_write_command(bytes, p, src + anchor, len - anchor, 0, 0);
+}
+
+/* Read the more bytes of a length and add them to len. Returns 0 if the data
+ends before the length does. */
+static int qoi_lz_read_len(const unsigned char *bytes, size_t *p, size_t size, size_t *len) {
+	int b;
+	do {
+		if (*p >= size) {
+			return 0;
+		}
+		b = bytes[(*p)++];
+		*len += b;
+	} while (b == 255);
+	return 1;
+}
+
+/* Decompress size bytes from bytes into exactly len bytes at dst. Returns 1 on
+success or 0 if the block is invalid. Literals and matches are copied 16 and 8
+bytes at a time, which may write past their end as long as it is within dst. */
+static int qoi_lz_decompress_block(const unsigned char *bytes, size_t size, unsigned char *dst, size_t len) {
+	size_t p = 0, q = 0;
+
+	for (;;) {
+		size_t lit, offset, match_len;
+		int token;
+
+		if (p >= size) {
+			return 0;
+		}
+		token = bytes[p++];
+		lit = (size_t)token >> 4;
+		if (lit == 15 && !qoi_lz_read_len(bytes, &p, size, &lit)) {
+			return 0;
+		}
+		if (lit > size - p || lit > len - q) {
+			return 0;
+		}
+		if (lit <= 16 && size - p >= 16 && len - q >= 16) {
+			memcpy(dst + q, bytes + p, 16);
+		}
+		else {
+			memcpy(dst + q, bytes + p, lit);
+		}
+		p += lit;
+		q += lit;
+
+		if (p == size) {
+			return q == len;
+		}
+		if (size - p < 2) {
+			return 0;
+		}
+		offset = bytes[p] | (size_t)bytes[p + 1] << 8;
+		p += 2;
+		match_len = (size_t)(token & 15) + QOI_LZ_MIN_MATCH;
+		if ((token & 15) == 15 && !qoi_lz_read_len(bytes, &p, size, &match_len)) {
+			return 0;
+		}
+		if (offset == 0 || offset > q || match_len > len - q) {
+			return 0;
+		}
+
+		if (offset >= 8 && len - q - match_len >= 8) {
+			unsigned char *d = dst + q, *end = d + match_len;
+			do {
+				memcpy(d, d - offset, 8);
+				d += 8;
+			} while (d < end);
+		}
+		else {
+			size_t i;
+			for (i = 0; i < match_len; i++) {
+				dst[q + i] = dst[q + i - offset];
+			}
+		}
+		q += match_len;
+	}
+}
+
+static size_t qoi_lz_block_len(const qoi_lz_job_t *job, size_t i) {
+	size_t start = i * job->block_size;
+	return job->size - start < job->block_size ? job->size - start : job->block_size;
+}
+
+static void qoi_lz_pack_block(void *user, size_t i) {
+	qoi_lz_job_t *job = (qoi_lz_job_t *)user;
+	const unsigned char *src = job->src + i * job->block_size;
+	unsigned char *dst = job->dst + i * job->block_size;
+	size_t len = qoi_lz_block_len(job, i);
+	size_t size = qoi_lz_compress_block(src, len, dst);
+
+	if (size == 0) {
+		memcpy(dst, src, len);
+		size = len;
+	}
+	job->blocks[i].size = size;
+}
+
+/* Decompress block first + i to dst + i * block_size */
+static void qoi_lz_unpack_block(void *user, size_t i) {
+	qoi_lz_job_t *job = (qoi_lz_job_t *)user;
+	qoi_lz_block_t *block = &job->blocks[job->first + i];
+	unsigned char *dst = job->dst + i * job->block_size;
+	size_t len = qoi_lz_block_len(job, job->first + i);
+
+	if (block->size == len) {
+		memcpy(dst, job->src + block->offset, len);
+		block->ok = 1;
+	}
+	else {
+		block->ok = qoi_lz_decompress_block(job->src + block->offset, block->size, dst, len);
+	}
+}
+
+void *qoi_lz_pack(const void *data, size_t size, size_t block_size, int nthreads, size_t *out_len) {
+	return qoi_ctx_lz_pack(NULL, data, size, block_size, nthreads, out_len);
+}
+
+void *qoi_ctx_lz_pack(
+	qoi_ctx *ctx, const void *data, size_t size, size_t block_size, int nthreads, size_t *out_len
+) {
+	qoi_lz_job_t job;
+	unsigned char *bytes;
+	size_t count, head, max_size, blocks_size, i, p, t;
+
+	if (block_size == 0) {
+		block_size = QOI_LZ_BLOCK_SIZE;
+	}
+	if (data == NULL || out_len == NULL || block_size > QOI_LZ_BLOCK_MAX) {
+		return NULL;
+	}
+
+	count = size == 0 ? 0 : (size - 1) / block_size + 1;
+	if (
+		!qoi_size_mad(count, 4, QOI_LZ_HEADER_SIZE, &head) ||
+		!qoi_size_mad(size, 1, head, &max_size) ||
+		!qoi_size_mad(count, sizeof(qoi_lz_block_t), 1, &blocks_size)
+	) {
+		return NULL;
+	}
+
+	bytes = (unsigned char *) qoi_alloc_out(ctx, max_size);
+	if (!bytes) {
+		return NULL;
+	}
+	job.blocks = (qoi_lz_block_t *) qoi_alloc(ctx, blocks_size);
+	if (!job.blocks) {
+		qoi_free_out(ctx, bytes);
+		return NULL;
+	}
+
+	/* Each block is packed into the room of its unpacked size and the packed
+	blocks are then moved together */
+	job.src = (const unsigned char *)data;
+	job.dst = bytes + head;
+	job.size = size;
+	job.block_size = block_size;
+	qoi_parallel_for(qoi_lz_pack_block, &job, count, nthreads);
+
+	p = 0;
+	qoi_write_32(bytes, &p, QOI_LZ_MAGIC);
+	qoi_write_32(bytes, &p, (unsigned int)block_size);
+	qoi_write_64(bytes, &p, size);
+	for (i = 0, t = head; i < count; i++) {
+		memmove(bytes + t, job.dst + i * block_size, job.blocks[i].size);
+		t += job.blocks[i].size;
+		qoi_write_32(bytes, &p, (unsigned int)job.blocks[i].size);
+	}
+
+	qoi_free(ctx, job.blocks, blocks_size);
+	*out_len = t;
+	return bytes;
+}
+
+/* Read the header and the sizes of the blocks of packed data into job,
+allocating job->blocks with ctx. Returns 1 on success or 0 if the data is
+invalid or memory could not be allocated. */
+static int qoi_lz_open(qoi_ctx *ctx, qoi_lz_job_t *job, const void *data, size_t size) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned long long unpacked_size;
+	size_t blocks_size, i, p = 0, t;
+
+	if (data == NULL || size < QOI_LZ_HEADER_SIZE) {
+		return 0;
+	}
+
+	if (qoi_read_32(bytes, &p) != QOI_LZ_MAGIC) {
+		return 0;
+	}
+	job->block_size = qoi_read_32(bytes, &p);
+	unpacked_size = qoi_read_64(bytes, &p);
+	if (
+		job->block_size == 0 || job->block_size > QOI_LZ_BLOCK_MAX ||
+		unpacked_size != (size_t)unpacked_size
+	) {
+		return 0;
+	}
+
+	job->size = (size_t)unpacked_size;
+	job->count = job->size == 0 ? 0 : (job->size - 1) / job->block_size + 1;
+	if (
+		job->count > (size - QOI_LZ_HEADER_SIZE) / 4 ||
+		!qoi_size_mad(job->count, sizeof(qoi_lz_block_t), 1, &blocks_size)
+	) {
+		return 0;
+	}
+
+	job->blocks = (qoi_lz_block_t *) qoi_alloc(ctx, blocks_size);
+	if (!job->blocks) {
+		return 0;
+	}
+
+	/* The packed blocks follow each other, so their offsets are the running
+	sum of their sizes. A packed block is never larger than its data. */
+	for (i = 0, t = QOI_LZ_HEADER_SIZE + job->count * 4; i < job->count; i++) {
+		size_t block = qoi_read_32(bytes, &p);
+		if (block == 0 || block > qoi_lz_block_len(job, i) || block > size - t) {
+			qoi_free(ctx, job->blocks, blocks_size);
+			return 0;
+		}
+		job->blocks[i].offset = t;
+		job->blocks[i].size = block;
+		t += block;
+	}
+
+	if (t != size) {
+		qoi_free(ctx, job->blocks, blocks_size);
+		return 0;
+	}
+	job->src = bytes;
+	job->first = 0;
+	return 1;
+}
+
+static void qoi_lz_close(qoi_ctx *ctx, qoi_lz_job_t *job) {
+	qoi_free(ctx, job->blocks, sizeof(qoi_lz_block_t) * job->count + 1);
+}
+
+/* Decompress count blocks, starting with block first, on nthreads threads into
+out. Returns 1 on success or 0 if a block is invalid. */
+static int qoi_lz_run_unpack(qoi_lz_job_t *job, size_t first, size_t count, unsigned char *out, int nthreads) {
+	size_t i;
+	int ok = 1;
+
+	job->first = first;
+	job->dst = out;
+	qoi_parallel_for(qoi_lz_unpack_block, job, count, nthreads);
+
+	for (i = first; i < first + count; i++) {
+		ok &= job->blocks[i].ok;
+	}
+	return ok;
+}
+
+void *qoi_lz_unpack(const void *data, size_t size, int nthreads, size_t *out_len) {
+	return qoi_ctx_lz_unpack(NULL, data, size, nthreads, out_len);
+}
+
+void *qoi_ctx_lz_unpack(qoi_ctx *ctx, const void *data, size_t size, int nthreads, size_t *out_len) {
+	qoi_lz_job_t job;
+	unsigned char *out;
+
+	if (out_len == NULL || !qoi_lz_open(ctx, &job, data, size)) {
+		return NULL;
+	}
+
+	out = (unsigned char *) qoi_alloc_out(ctx, job.size > 0 ? job.size : 1);
+	if (out && !qoi_lz_run_unpack(&job, 0, job.count, out, nthreads)) {
+		qoi_free_out(ctx, out);
+		out = NULL;
+	}
+	qoi_lz_close(ctx, &job);
+	if (out) {
+		*out_len = job.size;
+	}
+	return out;
+}
+
+void *qoi_lz_encode(const void *data, const qoi_desc *desc, int nthreads, size_t *out_len) {
+	return qoi_ctx_lz_encode(NULL, data, desc, nthreads, out_len);
+}
+
+void *qoi_ctx_lz_encode(qoi_ctx *ctx, const void *data, const qoi_desc *desc, int nthreads, size_t *out_len) {
+	unsigned char *bytes, *packed;
+	size_t max_size, size;
+
+	max_size = qoi_max_encoded_size(desc);
+	if (data == NULL || out_len == NULL || max_size == 0) {
+		return NULL;
+	}
+
+	/* The QOI image is temporary; only the packed data goes into the buffer of
+	the context */
+	bytes = (unsigned char *) qoi_alloc(ctx, max_size);
+	if (!bytes) {
+		return NULL;
+	}
+	size = qoi_encode_parallel_into(data, desc, nthreads, bytes, ctx);
+	packed = size > 0 ? (unsigned char *)qoi_ctx_lz_pack(ctx, bytes, size, 0, nthreads, out_len) : NULL;
+	qoi_free(ctx, bytes, max_size);
+	return packed;
+}
+
+void *qoi_lz_decode(const void *data, size_t size, qoi_desc *desc, int channels, int nthreads) {
+	return qoi_ctx_lz_decode(NULL, data, size, desc, channels, nthreads);
+}
+
+/* Check whether the unpacked data ends with the magic bytes of a seek index,
+decompressing only the last block */
+static int qoi_lz_has_seek_index(qoi_ctx *ctx, qoi_lz_job_t *job) {
+	unsigned char *last;
+	size_t len, p;
+	int found;
+
+	len = job->count > 0 ? qoi_lz_block_len(job, job->count - 1) : 0;
+	if (len < 4) {
+		return 0;
+	}
+
+	last = (unsigned char *) qoi_alloc(ctx, len);
+	if (!last) {
+		return 0;
+	}
+	p = len - 4;
+	found =
+		qoi_lz_run_unpack(job, job->count - 1, 1, last, 1) &&
+		qoi_read_32(last, &p) == QOI_SEEK_MAGIC;
+	qoi_free(ctx, last, len);
+	return found;
+}
+
+/* Bytes that are kept in the window when it is refilled. Decoding pauses when
+fewer than these are left, so that every pause decodes at least
+QOI_LZ_DECODE_KEEP / 5 pixels; no pixel takes more than 5 bytes. */
+#define QOI_LZ_DECODE_KEEP 64
+
+/* Decompress the blocks of job, nthreads at a time, into a window and decode
+the QOI image from it, resuming the decoder state from one window to the next.
+Until the last block is in the window, only as many pixels are decoded as the
+bytes in the window are sure to cover. Blocks are decompressed in parallel;
+the QOI image is decoded on the calling thread with the same kernel as
+qoi_decode_into() and thus gives the same pixels. */
+static void *qoi_lz_decode_stream(
+	qoi_ctx *ctx, qoi_lz_job_t *job, qoi_desc *desc, int channels, int nthreads
+) {
+	qoi_rgba_t index[64];
+	qoi_rgba_t px;
+	unsigned char *window, *pixels = NULL;
+	size_t group, group_size, window_size, next, n, i;
+	size_t base, len, p, chunks_end, limit, px_len, pos, bpp;
+	int run, ok = 1;
+
+	group = nthreads > 1 ? (size_t)nthreads : 1;
+	if (group > job->count) {
+		group = job->count;
+	}
+	if (!qoi_size_mad(group, job->block_size, 0, &group_size) || group_size > job->size) {
+		group_size = job->size;
+	}
+	if (
+		job->size < QOI_HEADER_SIZE + sizeof(qoi_padding) ||
+		!qoi_size_mad(group_size, 1, QOI_LZ_DECODE_KEEP + 16, &window_size)
+	) {
+		return NULL;
+	}
+	window = (unsigned char *) qoi_alloc(ctx, window_size);
+	if (!window) {
+		return NULL;
+	}
+	memset(window, 0, window_size);
+
+	/* base is the offset of window[0] within the QOI image */
+	chunks_end = job->size - sizeof(qoi_padding);
+	base = len = p = next = 0;
+	px_len = pos = bpp = 0;
+	QOI_ZEROARR(index);
+	qoi_init_state(&px, &run);
+
+	while (ok && (pixels == NULL || pos < px_len)) {
+		/* Refill, keeping the bytes not decoded yet */
+		while (ok && next < job->count && len - p < QOI_LZ_DECODE_KEEP) {
+			memmove(window, window + p, len - p);
+			base += p;
+			len -= p;
+			p = 0;
+
+			n = job->count - next < group ? job->count - next : group;
+			ok = qoi_lz_run_unpack(job, next, n, window + len, nthreads);
+			for (i = 0; i < n; i++) {
+				len += qoi_lz_block_len(job, next + i);
+			}
+			next += n;
+		}
+		if (!ok) {
+			break;
+		}
+
+		if (pixels == NULL) {
+			ok =
+				qoi_read_header(window, len, desc) &&
+				qoi_check_image_size(desc, job->size, channels, ~0ull, &px_len);
+			pixels = ok ? (unsigned char *) qoi_alloc_out(ctx, px_len) : NULL;
+			ok = pixels != NULL;
+			bpp = qoi_format_size(channels ? channels : desc->channels);
+			p = QOI_HEADER_SIZE;
+			continue;
+		}
+
+		limit = chunks_end > base ? chunks_end - base : 0;
+		if (limit > len) {
+			limit = len;
+		}
+		if (limit < p) {
+			limit = p;
+		}
+		n = px_len - pos;
+		if (next < job->count && (limit - p) / 5 * bpp < n) {
+			n = (limit - p) / 5 * bpp;
+		}
+		qoi_decode_span_fast(
+			window, &p, limit, index, &px, &run,
+			pixels + pos, n, channels ? channels : desc->channels
+		);
+		pos += n;
+	}
+
+	qoi_free(ctx, window, window_size);
+	if (!ok) {
+		qoi_free_out(ctx, pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+void *qoi_ctx_lz_decode(qoi_ctx *ctx, const void *data, size_t size, qoi_desc *desc, int channels, int nthreads) {
+	qoi_lz_job_t job;
+	unsigned char *bytes, *pixels;
+
+	if (
+		desc == NULL || (channels != 0 && channels != 3 && channels != 4) ||
+		!qoi_lz_open(ctx, &job, data, size)
+	) {
+		return NULL;
+	}
+
+	if (nthreads <= 1 || !qoi_lz_has_seek_index(ctx, &job)) {
+		pixels = (unsigned char *)qoi_lz_decode_stream(ctx, &job, desc, channels, nthreads);
+		qoi_lz_close(ctx, &job);
+		return pixels;
+	}
+
+	/* The seek index entries point anywhere into the QOI image, so it is
+	unpacked as a whole to decode its stripes in parallel */
+	bytes = (unsigned char *) qoi_alloc(ctx, job.size);
+	pixels = bytes && qoi_lz_run_unpack(&job, 0, job.count, bytes, nthreads)
+		? (unsigned char *)qoi_decode_alloc(ctx, bytes, job.size, desc, channels, nthreads, ~0ull)
+		: NULL;
+	qoi_free(ctx, bytes, job.size);
+	qoi_lz_close(ctx, &job);
+	return pixels;
+}
+
+/* -----------------------------------------------------------------------------
+Tiled images
+
+A tiled image starts with a header:
+
+struct qoi_tiled_header_t {
+	char     magic[4];     // magic bytes "qoit"
+	uint32_t width;        // image width in pixels (BE)
+	uint32_t height;       // image height in pixels (BE)
+	uint8_t  channels;     // 3 = RGB, 4 = RGBA
+	uint8_t  colorspace;   // as for QOI images
+	uint32_t tile_width;   // tile width in pixels (BE)
+	uint32_t tile_height;  // tile height in pixels (BE)
+};
+
+It is followed by the offset of every tile from the start of the data as
+uint64_t (BE), row by row, and then the offset of the end of the last tile. The
+tiles follow in the same order, each a complete QOI image. */
+
+#define QOI_TILED_MAGIC \
+	(((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+	 ((unsigned int)'i') <<  8 | ((unsigned int)'t'))
+#define QOI_TILED_HEADER_SIZE 22
+
+typedef struct {
+	size_t offset;
+	size_t size;
+	int ok;
+} qoi_tile_t;
+
+typedef struct {
+	const unsigned char *pixels;
+	unsigned char *bytes;
+	qoi_desc desc;
+	unsigned int tile_width;
+	unsigned int tile_height;
+	unsigned int tiles_x;
+	qoi_tile_t *tiles;
+} qoi_tiled_encode_t;
+
+typedef struct {
+	const qoi_tiled *tiled;
+	const unsigned char *bytes;
+	qoi_ctx *ctx;
+	qoi_tile_t *tiles;
+	unsigned int tx, ty, cols;
+	unsigned int x, y, w, h;
+	unsigned char *pixels;
+	ptrdiff_t stride;
+	int channels;
+} qoi_tiled_decode_t;
+
+/* Set x, y, w, h to the rectangle covered by the tile in column tx and row ty */
+static void qoi_tile_rect(
+	const qoi_desc *desc, unsigned int tile_width, unsigned int tile_height,
+	unsigned int tx, unsigned int ty,
+	unsigned int *x, unsigned int *y, unsigned int *w, unsigned int *h
+) {
+	*x = tx * tile_width;
+	*y = ty * tile_height;
+	*w = desc->width - *x < tile_width ? desc->width - *x : tile_width;
+	*h = desc->height - *y < tile_height ? desc->height - *y : tile_height;
+}
+
+static void qoi_encode_tile(void *user, size_t k) {
+	qoi_tiled_encode_t *job = (qoi_tiled_encode_t *)user;
+	qoi_tile_t *tile = &job->tiles[k];
+	qoi_desc desc = job->desc;
+	unsigned int x, y;
+
+	qoi_tile_rect(
+		&job->desc, job->tile_width, job->tile_height,
+		(unsigned int)(k % job->tiles_x), (unsigned int)(k / job->tiles_x),
+		&x, &y, &desc.width, &desc.height
+	);
+	tile->size = qoi_encode_rect(
+		job->pixels, (ptrdiff_t)job->desc.width * job->desc.channels, x, y,
+		&desc, job->bytes + tile->offset, tile->size
+	);
+}
+
+void *qoi_encode_tiled(
+	const void *data, const qoi_desc *desc, unsigned int tile_width,
+	unsigned int tile_height, int nthreads, size_t *out_len
+) {
+	return qoi_ctx_encode_tiled(NULL, data, desc, tile_width, tile_height, nthreads, out_len);
+}
+
+void *qoi_ctx_encode_tiled(
+	qoi_ctx *ctx, const void *data, const qoi_desc *desc, unsigned int tile_width,
+	unsigned int tile_height, int nthreads, size_t *out_len
+) {
+	qoi_tiled_encode_t job;
+	unsigned int tiles_y;
+	size_t count, head, max_size, tiles_size, k, p, t;
+
+	if (tile_width == 0) {
+		tile_width = QOI_TILE_SIZE;
+	}
+	if (tile_height == 0) {
+		tile_height = QOI_TILE_SIZE;
+	}
+	if (data == NULL || desc == NULL || out_len == NULL || !qoi_valid_desc(desc)) {
+		return NULL;
+	}
+
+	job.tiles_x = (desc->width - 1) / tile_width + 1;
+	tiles_y = (desc->height - 1) / tile_height + 1;
+	if (
+		!qoi_size_mad(job.tiles_x, tiles_y, 0, &count) ||
+		!qoi_size_mad(count + 1, 8, QOI_TILED_HEADER_SIZE, &head) ||
+		!qoi_size_mad(count, sizeof(qoi_tile_t), 0, &tiles_size)
+	) {
+		return NULL;
+	}
+
+	job.tiles = (qoi_tile_t *) qoi_alloc(ctx, tiles_size);
+	if (!job.tiles) {
+		return NULL;
+	}
+
+	/* Each tile is encoded into a slot of its worst case size; the encoded
+	tiles are then moved together */
+	max_size = head;
+	for (k = 0; k < count; k++) {
+		qoi_desc tile_desc = *desc;
+		unsigned int x, y;
+		size_t slot;
+
+		qoi_tile_rect(
+			desc, tile_width, tile_height,
+			(unsigned int)(k % job.tiles_x), (unsigned int)(k / job.tiles_x),
+			&x, &y, &tile_desc.width, &tile_desc.height
+		);
+		slot = qoi_max_encoded_size(&tile_desc);
+		if (slot == 0 || max_size + slot < max_size) {
+			qoi_free(ctx, job.tiles, tiles_size);
+			return NULL;
+		}
+		job.tiles[k].offset = max_size;
+		job.tiles[k].size = slot;
+		max_size += slot;
+	}
+
+	job.bytes = (unsigned char *) qoi_alloc_out(ctx, max_size);
+	if (!job.bytes) {
+		qoi_free(ctx, job.tiles, tiles_size);
+		return NULL;
+	}
+
+	job.pixels = (const unsigned char *)data;
+	job.desc = *desc;
+	job.tile_width = tile_width;
+	job.tile_height = tile_height;
+#if defined(QOI_SIMD_SSE2)
+	qoi_cpu_isa();
+#endif
+	qoi_parallel_for(qoi_encode_tile, &job, count, nthreads);
+
+	p = 0;
+	qoi_write_32(job.bytes, &p, QOI_TILED_MAGIC);
+	qoi_write_32(job.bytes, &p, desc->width);
+	qoi_write_32(job.bytes, &p, desc->height);
+	job.bytes[p++] = desc->channels;
+	job.bytes[p++] = desc->colorspace;
+	qoi_write_32(job.bytes, &p, tile_width);
+	qoi_write_32(job.bytes, &p, tile_height);
+
+	for (k = 0, t = head; k < count; k++) {
+		if (job.tiles[k].size == 0) {
+			qoi_free(ctx, job.tiles, tiles_size);
+			qoi_free_out(ctx, job.bytes);
+			return NULL;
+		}
+		memmove(job.bytes + t, job.bytes + job.tiles[k].offset, job.tiles[k].size);
+		qoi_write_64(job.bytes, &p, t);
+		t += job.tiles[k].size;
+	}
+	qoi_write_64(job.bytes, &p, t);
+
+	qoi_free(ctx, job.tiles, tiles_size);
+	*out_len = t;
+	return job.bytes;
+}
+
+/* Read the QOI_TILED_HEADER_SIZE bytes of the header into tiled. Returns the
+size of the header and offset table, or 0 if the header is invalid. */
+static size_t qoi_tiled_read_header(qoi_tiled *tiled, const unsigned char *bytes) {
+	size_t p = 0, count, head;
+
+	if (qoi_read_32(bytes, &p) != QOI_TILED_MAGIC) {
+		return 0;
+	}
+	tiled->desc.width = qoi_read_32(bytes, &p);
+	tiled->desc.height = qoi_read_32(bytes, &p);
+	tiled->desc.channels = bytes[p++];
+	tiled->desc.colorspace = bytes[p++];
+	tiled->tile_width = qoi_read_32(bytes, &p);
+	tiled->tile_height = qoi_read_32(bytes, &p);
+
+	if (!qoi_valid_desc(&tiled->desc) || tiled->tile_width == 0 || tiled->tile_height == 0) {
+		return 0;
+	}
+
+	tiled->tiles_x = (tiled->desc.width - 1) / tiled->tile_width + 1;
+	tiled->tiles_y = (tiled->desc.height - 1) / tiled->tile_height + 1;
+	if (
+		!qoi_size_mad(tiled->tiles_x, tiled->tiles_y, 0, &count) ||
+		!qoi_size_mad(count + 1, 8, QOI_TILED_HEADER_SIZE, &head)
+	) {
+		return 0;
+	}
+	return head;
+}
+
+/* Check that the offsets in the table at table, following the header, point to
+the head size bytes of tiles of the image. The tiles must follow each other in
+order and end within the size bytes of the image. */
+static int qoi_tiled_check_table(const qoi_tiled *tiled, const unsigned char *table, size_t head, size_t size) {
+	size_t count = (size_t)tiled->tiles_x * tiled->tiles_y;
+	size_t k, p = 0;
+	unsigned long long prev = head;
+
+	for (k = 0; k <= count; k++) {
+		unsigned long long offset = qoi_read_64(table, &p);
+		if (offset < prev || offset > size) {
+			return 0;
+		}
+		prev = offset;
+	}
+	return 1;
+}
+
+int qoi_tiled_open(qoi_tiled *tiled, const void *data, size_t size) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	size_t head;
+
+	if (tiled == NULL || data == NULL || size < QOI_TILED_HEADER_SIZE) {
+		return 0;
+	}
+
+	head = qoi_tiled_read_header(tiled, bytes);
+	if (
+		head == 0 || head > size ||
+		!qoi_tiled_check_table(tiled, bytes + QOI_TILED_HEADER_SIZE, head, size)
+	) {
+		return 0;
+	}
+
+	tiled->bytes = bytes;
+	tiled->size = size;
+	return 1;
+}
+
+/* Set offset and size to the position of tile k in the table at table */
+static void qoi_tiled_range(const unsigned char *table, size_t k, size_t *offset, size_t *size) {
+	size_t p = k * 8;
+	*offset = (size_t)qoi_read_64(table, &p);
+	*size = (size_t)qoi_read_64(table, &p) - *offset;
+}
+
+const void *qoi_tiled_tile(const qoi_tiled *tiled, unsigned int tx, unsigned int ty, size_t *size) {
+	size_t offset;
+
+	if (tiled == NULL || size == NULL || tx >= tiled->tiles_x || ty >= tiled->tiles_y) {
+		return NULL;
+	}
+
+	qoi_tiled_range(
+		tiled->bytes + QOI_TILED_HEADER_SIZE,
+		(size_t)ty * tiled->tiles_x + tx, &offset, size
+	);
+	return tiled->bytes + offset;
+}
+
+/* Set up job to decode the w * h pixels at x, y, which must lie within the
+image, from the tiles they overlap. Returns the number of these tiles, with
+their position in the table at table stored in job->tiles, or 0 if the list of
+tiles could not be allocated with ctx. */
+static size_t qoi_tiled_select(
+	qoi_ctx *ctx, const qoi_tiled *tiled, const unsigned char *table, qoi_tiled_decode_t *job,
+	unsigned int x, unsigned int y, unsigned int w, unsigned int h
+) {
+	unsigned int rows;
+	size_t count, tiles_size, k;
+
+	job->tiled = tiled;
+	job->ctx = ctx;
+	job->x = x;
+	job->y = y;
+	job->w = w;
+	job->h = h;
+	job->tx = x / tiled->tile_width;
+	job->ty = y / tiled->tile_height;
+	job->cols = (x + w - 1) / tiled->tile_width - job->tx + 1;
+	rows = (y + h - 1) / tiled->tile_height - job->ty + 1;
+
+	if (
+		!qoi_size_mad(job->cols, rows, 0, &count) ||
+		!qoi_size_mad(count, sizeof(qoi_tile_t), 0, &tiles_size)
+	) {
+		return 0;
+	}
+
+	job->tiles = (qoi_tile_t *) qoi_alloc(ctx, tiles_size);
+	if (!job->tiles) {
+		return 0;
+	}
+
+	for (k = 0; k < count; k++) {
+		qoi_tiled_range(
+			table,
+			(size_t)(job->ty + k / job->cols) * tiled->tiles_x + job->tx + k % job->cols,
+			&job->tiles[k].offset, &job->tiles[k].size
+		);
+	}
+	return count;
+}
+
+/* Decode the part of tile k that overlaps the rectangle. A tile that lies
+within the rectangle completely is decoded with qoi_decode_rect(), any other
+with qoi_decode_region(). The header of the tile must match its place in the image,
+so that no pixels are written outside of the rectangle. */
+static void qoi_decode_tile(void *user, size_t k) {
+	qoi_tiled_decode_t *job = (qoi_tiled_decode_t *)user;
+	qoi_tile_t *tile = &job->tiles[k];
+	const unsigned char *bytes = job->bytes + tile->offset;
+	unsigned int x, y, w, h, x0, y0, x1, y1;
+	qoi_desc desc;
+
+	qoi_tile_rect(
+		&job->tiled->desc, job->tiled->tile_width, job->tiled->tile_height,
+		job->tx + (unsigned int)(k % job->cols), job->ty + (unsigned int)(k / job->cols),
+		&x, &y, &w, &h
+	);
+	x0 = x > job->x ? x : job->x;
+	y0 = y > job->y ? y : job->y;
+	x1 = x + w < job->x + job->w ? x + w : job->x + job->w;
+	y1 = y + h < job->y + job->h ? y + h : job->y + job->h;
+
+	if (!qoi_read_header(bytes, tile->size, &desc) || desc.width != w || desc.height != h) {
+		tile->ok = 0;
+	}
+	else if (x0 == x && y0 == y && x1 == x + w && y1 == y + h) {
+		tile->ok = qoi_decode_rect(
+			bytes, tile->size, &desc, job->pixels, job->stride,
+			x0 - job->x, y0 - job->y, job->channels
+		);
+	}
+	else {
+		tile->ok = qoi_decode_region(
+			bytes, tile->size, &desc, x0 - x, y0 - y, x1 - x0, y1 - y0,
+			job->pixels + (ptrdiff_t)(y0 - job->y) * job->stride + (size_t)(x0 - job->x) * job->channels,
+			job->stride, job->channels
+		);
+	}
+}
+
+/* Decode count tiles selected by qoi_tiled_select(), with their offsets now
+relative to job->bytes, and free the list of tiles */
+static int qoi_tiled_decode(qoi_tiled_decode_t *job, size_t count, int nthreads) {
+	size_t k;
+	int ok = 1;
+
+#if defined(QOI_SIMD_SSE2)
+	qoi_cpu_isa();
+#endif
+	qoi_parallel_for(qoi_decode_tile, job, count, nthreads);
+
+	for (k = 0; k < count; k++) {
+		ok &= job->tiles[k].ok;
+	}
+	qoi_free(job->ctx, job->tiles, sizeof(qoi_tile_t) * count);
+	return ok;
+}
+
+int qoi_tiled_decode_rect(
+	const qoi_tiled *tiled, unsigned int x, unsigned int y, unsigned int w,
+	unsigned int h, void *pixels, ptrdiff_t stride, int channels, int nthreads
+) {
+	return qoi_ctx_tiled_decode_rect(NULL, tiled, x, y, w, h, pixels, stride, channels, nthreads);
+}
+
+int qoi_ctx_tiled_decode_rect(
+	qoi_ctx *ctx, const qoi_tiled *tiled, unsigned int x, unsigned int y, unsigned int w,
+	unsigned int h, void *pixels, ptrdiff_t stride, int channels, int nthreads
+) {
+	qoi_tiled_decode_t job;
+	size_t count;
+
+	if (
+		tiled == NULL || pixels == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		x > tiled->desc.width || w > tiled->desc.width - x ||
+		y > tiled->desc.height || h > tiled->desc.height - y
+	) {
+		return 0;
+	}
+	if (w == 0 || h == 0) {
+		return 1;
+	}
+
+	count = qoi_tiled_select(ctx, tiled, tiled->bytes + QOI_TILED_HEADER_SIZE, &job, x, y, w, h);
+	if (count == 0) {
+		return 0;
+	}
+
+	job.bytes = tiled->bytes;
+	job.pixels = (unsigned char *)pixels;
+	job.stride = stride;
+	job.channels = channels != 0 ? channels : tiled->desc.channels;
+	return qoi_tiled_decode(&job, count, nthreads);
+}
+
+
+#ifndef QOI_NO_STDIO
+#include <stdio.h>
+
+/* ftell() returns a long, which is only 32 bit on Windows */
+#if defined(_WIN32)
+	#define QOI_FSEEK(f, off, whence) _fseeki64(f, off, whence)
+	#define QOI_FTELL(f) _ftelli64(f)
+#else
+	#define QOI_FSEEK(f, off, whence) fseek(f, off, whence)
+	#define QOI_FTELL(f) ftell(f)
+#endif
+
+/* On POSIX systems, qoi_read() decodes straight from a read-only mapping of
+the file. On Linux, qoi_write64() reserves the worst case size on disk with
+fallocate(), encodes straight into a mapping of the file and then truncates it
+to the encoded size. fallocate() is only declared with _GNU_SOURCE, which is
+checked through FALLOC_FL_KEEP_SIZE that comes with it; without it,
+qoi_write64() uses stdio. If any of this fails, they fall back to stdio. Define
+QOI_NO_MMAP to always use stdio. */
+#if !defined(QOI_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+	#define QOI_MMAP
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+
+	#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+		#define QOI_MMAP_WRITE
+	#endif
+#endif
+
+#if defined(QOI_MMAP_WRITE)
+static int qoi_write_mapped(const char *filename, const void *data, const qoi_desc *desc, size_t *out_len) {
+	size_t max_size = qoi_max_encoded_size(desc);
+	void *map;
+	int fd;
+
+	if (max_size == 0 || (off_t)max_size < 0 || (size_t)(off_t)max_size != max_size) {
+		return 0;
+	}
+
+	fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		return 0;
+	}
+
+	/* Reserving the space up front makes sure that writing to the mapping
+	can't fail because the disk is full. File systems that can't reserve space
+	fail with EOPNOTSUPP; posix_fallocate() would instead write every block of
+	the worst case size, so the caller rather uses stdio then. */
+	if (fallocate(fd, 0, 0, (off_t)max_size) != 0) {
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return 0;
+	}
+
+	*out_len = qoi_encode_into(data, desc, map, max_size);
+	munmap(map, max_size);
+
+	if (ftruncate(fd, (off_t)*out_len) != 0) {
+		*out_len = 0;
+	}
+	close(fd);
+	return 1;
+}
+#endif
+
+typedef struct {
+	FILE *f;
+	size_t size;
+} qoi_file_writer_t;
+
+static int qoi_fwrite_fn(void *user, const void *data, size_t size) {
+	qoi_file_writer_t *writer = (qoi_file_writer_t *)user;
+	writer->size += size;
+	return fwrite(data, 1, size, writer->f) == size;
+}
+
+size_t qoi_write64(const char *filename, const void *data, const qoi_desc *desc) {
+	qoi_file_writer_t writer;
+	qoi_encoder enc;
+	int ok;
+
+	if (data == NULL || qoi_max_encoded_size(desc) == 0) {
+		return 0;
+	}
+
+#if defined(QOI_MMAP_WRITE)
+	if (qoi_write_mapped(filename, data, desc, &writer.size)) {
+		return writer.size;
+	}
+#endif
+
+	/* Encode through the streaming encoder, so that the encoded image is
+	never held in memory as a whole */
+	writer.f = fopen(filename, "wb");
+	writer.size = 0;
+	if (!writer.f) {
+		return 0;
+	}
+
+	ok =
+		qoi_encoder_init(&enc, desc, qoi_fwrite_fn, &writer) &&
+		qoi_encoder_push(&enc, data, (size_t)desc->width * desc->height) &&
+		qoi_encoder_finish(&enc);
+
+	if (fclose(writer.f) != 0) {
+		ok = 0;
+	}
+	return ok ? writer.size : 0;
+}
+
+int qoi_write(const char *filename, const void *data, const qoi_desc *desc) {
+	if (desc == NULL || desc->width == 0 || desc->height >= QOI_PIXELS_MAX / desc->width) {
+		return 0;
+	}
+	return (int)qoi_write64(filename, data, desc);
+}
+
+#if defined(QOI_MMAP)
+/* Map the whole file read-only and set size to its size. Returns NULL if the
+file could not be mapped. */
+static void *qoi_map_file(const char *filename, size_t *size) {
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (
+		fstat(fd, &st) != 0 || st.st_size <= 0 ||
+		(unsigned long long)st.st_size > (size_t)-1
+	) {
+		close(fd);
+		return NULL;
+	}
+
+	*size = (size_t)st.st_size;
+	map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	return map != MAP_FAILED ? map : NULL;
+}
+
+/* Returns 0 if the file could not be mapped, or 1 otherwise with the decoded
+pixels or NULL in pixels */
+static int qoi_read_mapped(
+	const char *filename, qoi_desc *desc, int channels,
+	unsigned long long max_pixels, void **pixels
+) {
+	size_t size;
+	void *map = qoi_map_file(filename, &size);
+
+	if (!map) {
+		return 0;
+	}
+
+#if defined(MADV_SEQUENTIAL)
+	madvise(map, size, MADV_SEQUENTIAL);
+#elif defined(POSIX_MADV_SEQUENTIAL)
+	posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+#endif
+
+	*pixels = qoi_decode_alloc(NULL, map, size, desc, channels, 1, max_pixels);
+	munmap(map, size);
+	return 1;
+}
+#endif
+
+/* Read and decode the file, refusing images with more than max_pixels pixels */
+static void *qoi_read_max(const char *filename, qoi_desc *desc, int channels, unsigned long long max_pixels) {
+	FILE *f;
+	size_t size, bytes_read;
+	void *pixels, *data;
+
+#if defined(QOI_MMAP)
+	if (qoi_read_mapped(filename, desc, channels, max_pixels, &pixels)) {
+		return pixels;
+	}
+#endif
+
+	f = fopen(filename, "rb");
+	if (!f) {
 		return NULL;
 	}
 
-	fseek(f, 0, SEEK_END);
-	size = ftell(f);
-	if (size <= 0) {
+	QOI_FSEEK(f, 0, SEEK_END);
+	size = QOI_FTELL(f) > 0 ? (size_t)QOI_FTELL(f) : 0;
+	if (size == 0) {
 		fclose(f);
 		return NULL;
 	}
-	fseek(f, 0, SEEK_SET);
+	QOI_FSEEK(f, 0, SEEK_SET);
 
 	data = QOI_MALLOC(size);
 	if (!data) {
@@ -640,10 +6141,170 @@ void *qoi_read(const char *filename, qoi_desc *desc, int channels) {
 	bytes_read = fread(data, 1, size, f);
 	fclose(f);
 
-	pixels = qoi_decode(data, bytes_read, desc, channels);
+	pixels = qoi_decode_alloc(NULL, data, bytes_read, desc, channels, 1, max_pixels);
 	QOI_FREE(data);
 	return pixels;
 }
 
+void *qoi_read(const char *filename, qoi_desc *desc, int channels) {
+	return qoi_read_max(filename, desc, channels, QOI_PIXELS_MAX);
+}
+
+void *qoi_read64(const char *filename, qoi_desc *desc, int channels) {
+	return qoi_read_max(filename, desc, channels, ~0ull);
+}
+
+/* Read the header and offset table of a tiled image file into tiled and then
+the tiles that overlap the rectangle at x, y. The tiles of a row of tiles are
+adjacent in the file and are read at once. Returns a buffer with the tiles,
+with job set up as by qoi_tiled_select() and the offsets of the tiles relative
+to the buffer, and sets count to the number of tiles, or returns NULL. */
+static unsigned char *qoi_read_tiles(
+	const char *filename, qoi_tiled *tiled, qoi_tiled_decode_t *job,
+	unsigned int x, unsigned int y, unsigned int w, unsigned int h, size_t *count
+) {
+	unsigned char header[QOI_TILED_HEADER_SIZE];
+	unsigned char *table = NULL, *buffer = NULL;
+	size_t size, head, total = 0, n = 0, k, j, t;
+	FILE *f;
+
+	f = fopen(filename, "rb");
+	if (!f) {
+		return NULL;
+	}
+
+	QOI_FSEEK(f, 0, SEEK_END);
+	size = QOI_FTELL(f) > 0 ? (size_t)QOI_FTELL(f) : 0;
+	QOI_FSEEK(f, 0, SEEK_SET);
+
+	head = size >= QOI_TILED_HEADER_SIZE && fread(header, 1, QOI_TILED_HEADER_SIZE, f) == QOI_TILED_HEADER_SIZE
+		? qoi_tiled_read_header(tiled, header)
+		: 0;
+	if (
+		head != 0 && head <= size &&
+		x <= tiled->desc.width && w <= tiled->desc.width - x &&
+		y <= tiled->desc.height && h <= tiled->desc.height - y
+	) {
+		table = (unsigned char *) QOI_MALLOC(head - QOI_TILED_HEADER_SIZE);
+	}
+	if (
+		table != NULL &&
+		fread(table, 1, head - QOI_TILED_HEADER_SIZE, f) == head - QOI_TILED_HEADER_SIZE &&
+		qoi_tiled_check_table(tiled, table, head, size)
+	) {
+		n = qoi_tiled_select(NULL, tiled, table, job, x, y, w, h);
+	}
+	QOI_FREE(table);
+
+	for (k = 0; k < n; k += job->cols) {
+		total += job->tiles[k + job->cols - 1].offset + job->tiles[k + job->cols - 1].size - job->tiles[k].offset;
+	}
+	if (n > 0) {
+		buffer = (unsigned char *) QOI_MALLOC(total > 0 ? total : 1);
+	}
+
+	for (k = 0, t = 0; buffer != NULL && k < n; k += job->cols) {
+		size_t start = job->tiles[k].offset;
+		size_t len = job->tiles[k + job->cols - 1].offset + job->tiles[k + job->cols - 1].size - start;
+
+		if (
+			QOI_FSEEK(f, start, SEEK_SET) != 0 ||
+			fread(buffer + t, 1, len, f) != len
+		) {
+			QOI_FREE(buffer);
+			buffer = NULL;
+			break;
+		}
+		for (j = k; j < k + job->cols; j++) {
+			job->tiles[j].offset = t + job->tiles[j].offset - start;
+		}
+		t += len;
+	}
+
+	fclose(f);
+	if (!buffer && n > 0) {
+		QOI_FREE(job->tiles);
+	}
+	*count = n;
+	return buffer;
+}
+
+void *qoi_read_tiled(
+	const char *filename, qoi_desc *desc, unsigned int x, unsigned int y,
+	unsigned int w, unsigned int h, int channels, int nthreads
+) {
+	qoi_tiled tiled;
+	qoi_tiled_decode_t job;
+	unsigned char *buffer = NULL, *pixels = NULL;
+	void *map = NULL;
+	size_t count = 0, px_len;
+#if defined(QOI_MMAP)
+	size_t size;
+#endif
+
+	if (
+		filename == NULL || desc == NULL || w == 0 || h == 0 ||
+		(channels != 0 && channels != 3 && channels != 4)
+	) {
+		return NULL;
+	}
+
+#if defined(QOI_MMAP)
+	map = qoi_map_file(filename, &size);
+	if (map) {
+		if (
+			qoi_tiled_open(&tiled, map, size) &&
+			x <= tiled.desc.width && w <= tiled.desc.width - x &&
+			y <= tiled.desc.height && h <= tiled.desc.height - y
+		) {
+			count = qoi_tiled_select(NULL, &tiled, tiled.bytes + QOI_TILED_HEADER_SIZE, &job, x, y, w, h);
+			job.bytes = tiled.bytes;
+		}
+	}
+#endif
+	if (!map) {
+		buffer = qoi_read_tiles(filename, &tiled, &job, x, y, w, h, &count);
+		job.bytes = buffer;
+		if (!buffer) {
+			count = 0;
+		}
+	}
+
+	if (count > 0) {
+		if (channels == 0) {
+			channels = tiled.desc.channels;
+		}
+		if (
+			qoi_size_mad(w, h, 0, &px_len) &&
+			qoi_size_mad(px_len, channels, 0, &px_len)
+		) {
+			pixels = (unsigned char *) QOI_MALLOC(px_len);
+		}
+		if (!pixels) {
+			QOI_FREE(job.tiles);
+		}
+		else {
+			job.pixels = pixels;
+			job.stride = (ptrdiff_t)w * channels;
+			job.channels = channels;
+			if (qoi_tiled_decode(&job, count, nthreads)) {
+				*desc = tiled.desc;
+			}
+			else {
+				QOI_FREE(pixels);
+				pixels = NULL;
+			}
+		}
+	}
+
+#if defined(QOI_MMAP)
+	if (map) {
+		munmap(map, size);
+	}
+#endif
+	QOI_FREE(buffer);
+	return pixels;
+}
+
 #endif /* QOI_NO_STDIO */
 #endif /* QOI_IMPLEMENTATION */
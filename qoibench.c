@@ -6,14 +6,29 @@ SPDX-License-Identifier: MIT
 
 Simple benchmark suite for png, stbi and qoi
 
+Runs on a directory of PNGs or on a built-in set of deterministic synthetic
+images (qoibench <runs> synthetic), which needs no image files. Either corpus
+works with every option. The exception is --threads, which only reports the
+aggregate throughput and so can't be combined with --json, --csv, --baseline,
+--stats, --lz or --reference.
+
 Requires libpng, "stb_image.h" and "stb_image_write.h"
 Compile with: 
-	gcc qoibench.c -std=gnu99 -lpng -O3 -o qoibench 
+	gcc qoibench.c -std=gnu99 -lpng -pthread -lm -O3 -o qoibench 
 
 */
 
+#if defined(__linux)
+	// for pthread_setaffinity_np()
+	#define _GNU_SOURCE
+	#include <sched.h>
+	#include <unistd.h>
+#endif
+
 #include <stdio.h>
+#include <math.h>
 #include <dirent.h>
+#include <pthread.h>
 #include <png.h>
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -25,6 +40,7 @@ Compile with:
 #include "stb_image_write.h"
 
 #define QOI_IMPLEMENTATION
+#define QOI_STATS
 #include "qoi.h"
 
 
@@ -262,6 +278,83 @@ void stbi_write_callback(void *context, void *data, int size) {
 }
 
 
+// -----------------------------------------------------------------------------
+// qoi_write_fn that appends to a growing buffer
+
+typedef struct {
+	unsigned char *data;
+	size_t size;
+	size_t capacity;
+} membuf_t;
+
+int membuf_write(void *user, const void *data, size_t size) {
+	membuf_t *buf = (membuf_t *)user;
+	if (buf->size + size > buf->capacity) {
+		size_t capacity = (buf->size + size) * 2;
+		unsigned char *grown = realloc(buf->data, capacity);
+		if (!grown) {
+			return 0;
+		}
+		buf->data = grown;
+		buf->capacity = capacity;
+	}
+	memcpy(buf->data + buf->size, data, size);
+	buf->size += size;
+	return 1;
+}
+
+
+// -----------------------------------------------------------------------------
+// qoi reference encoder and decoder, running the plain qoi_encode_span() and
+// qoi_decode_span() loops from qoi.h instead of the optimized kernels
+
+void *qoi_encode_reference(const void *data, const qoi_desc *desc, int *out_len) {
+	size_t max_size = qoi_max_encoded_size(desc);
+	unsigned char *bytes = malloc(max_size);
+	if (!bytes) {
+		return NULL;
+	}
+
+	qoi_rgba_t index[64] = {0};
+	qoi_rgba_t px_prev;
+	int run;
+	size_t p = qoi_write_header(bytes, 0, desc);
+	qoi_init_state(&px_prev, &run);
+	p = qoi_encode_span(
+		index, &px_prev, &run, data,
+		(size_t)desc->width * desc->height * desc->channels, desc->channels,
+		bytes, p
+	);
+	p = qoi_encode_end_run(&run, bytes, p);
+	memcpy(bytes + p, qoi_padding, sizeof(qoi_padding));
+	*out_len = p + sizeof(qoi_padding);
+	return bytes;
+}
+
+void *qoi_decode_reference(const void *data, int size, qoi_desc *desc, int channels) {
+	if (!qoi_read_header(data, size, desc)) {
+		return NULL;
+	}
+	if (channels == 0) {
+		channels = desc->channels;
+	}
+
+	size_t px_len = (size_t)desc->width * desc->height * channels;
+	unsigned char *pixels = malloc(px_len);
+	if (!pixels) {
+		return NULL;
+	}
+
+	qoi_rgba_t index[64] = {0};
+	qoi_rgba_t px;
+	int run;
+	size_t p = QOI_HEADER_SIZE;
+	qoi_init_state(&px, &run);
+	qoi_decode_span(data, &p, size - sizeof(qoi_padding), index, &px, &run, pixels, px_len, channels);
+	return pixels;
+}
+
+
 // -----------------------------------------------------------------------------
 // function to load a whole file into memory
 
@@ -290,6 +383,273 @@ void *fload(const char *path, int *out_size) {
 }
 
 
+// -----------------------------------------------------------------------------
+// Deterministic synthetic images, so that a benchmark can run without any PNG
+// files or libpng. All content is computed with integer math from the seed
+// alone and is the same on every platform.
+
+static uint32_t synth_hash(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+// xorshift32; the state must not be 0
+static uint32_t synth_rand(uint32_t *state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static int synth_range(uint32_t *state, int min, int max) {
+	return min + (int)(synth_rand(state) % (uint32_t)(max - min + 1));
+}
+
+// Smooth value noise in 0..255 on a lattice with a spacing of 1 << shift
+static int synth_noise(uint32_t seed, int x, int y, int shift) {
+	int ix = x >> shift, iy = y >> shift;
+	int fx = ((x & ((1 << shift) - 1)) << 8) >> shift;
+	int fy = ((y & ((1 << shift) - 1)) << 8) >> shift;
+	fx = fx * fx * (768 - 2 * fx) >> 16;
+	fy = fy * fy * (768 - 2 * fy) >> 16;
+
+	#define SYNTH_LATTICE(X, Y) \
+		(int)(synth_hash(seed ^ (uint32_t)(X) * 0x9e3779b1u ^ (uint32_t)(Y) * 0x85ebca77u) & 0xff)
+	int v00 = SYNTH_LATTICE(ix, iy), v10 = SYNTH_LATTICE(ix + 1, iy);
+	int v01 = SYNTH_LATTICE(ix, iy + 1), v11 = SYNTH_LATTICE(ix + 1, iy + 1);
+	#undef SYNTH_LATTICE
+
+	int top = v00 + (v10 - v00) * fx / 256;
+	int bottom = v01 + (v11 - v01) * fx / 256;
+	return top + (bottom - top) * fy / 256;
+}
+
+static unsigned char synth_clamp(int v) {
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// Fill a rectangle with an rgb color; alpha is left as is
+static void synth_fill(unsigned char *pixels, int w, int channels, int x0, int y0, int x1, int y1, const unsigned char *color) {
+	for (int y = y0; y < y1; y++) {
+		unsigned char *px = pixels + ((size_t)y * w + x0) * channels;
+		for (int x = x0; x < x1; x++, px += channels) {
+			memcpy(px, color, 3);
+		}
+	}
+}
+
+// Flat UI: a window with a title bar, panels, buttons and lines of text-like
+// glyphs in a few flat colors
+static void synth_ui(unsigned char *pixels, int w, int h, int channels, uint32_t seed) {
+	uint32_t rng = synth_hash(seed) | 1;
+	unsigned char bg[3] = {236, 236, 240};
+	unsigned char title[3] = {52, 101, 164};
+	unsigned char border[3] = {190, 190, 198};
+	unsigned char panel[3] = {250, 250, 252};
+	unsigned char text[3] = {40, 40, 48};
+
+	synth_fill(pixels, w, channels, 0, 0, w, h, bg);
+	synth_fill(pixels, w, channels, 0, 0, w, h < 32 ? h : 32, title);
+
+	for (int y = 40; y + 24 < h; ) {
+		int ph = synth_range(&rng, 24, 240);
+		if (y + ph > h - 8) {
+			ph = h - 8 - y;
+		}
+		for (int x = 8; x + 24 < w; ) {
+			int pw = synth_range(&rng, 24, 480);
+			if (x + pw > w - 8) {
+				pw = w - 8 - x;
+			}
+			synth_fill(pixels, w, channels, x, y, x + pw, y + ph, border);
+			synth_fill(pixels, w, channels, x + 1, y + 1, x + pw - 1, y + ph - 1, panel);
+
+			if (synth_range(&rng, 0, 3) == 0) {
+				// A button in an accent color
+				unsigned char accent[3] = {
+					synth_range(&rng, 0, 255), synth_range(&rng, 0, 255), synth_range(&rng, 0, 255)
+				};
+				int bw = pw < 96 ? pw - 8 : 88;
+				synth_fill(pixels, w, channels, x + 4, y + 4, x + 4 + bw, y + (ph < 28 ? ph - 4 : 24), accent);
+			}
+			else {
+				// Lines of 6x12 glyph cells, each a random 5x7 bitmap
+				for (int ty = y + 4; ty + 10 < y + ph; ty += 12) {
+					int line = synth_range(&rng, 0, (pw - 8) / 6);
+					for (int g = 0; g < line; g++) {
+						uint32_t bits = synth_rand(&rng);
+						if ((bits & 7) == 0) {
+							continue; // space
+						}
+						for (int i = 0; i < 35; i++) {
+							if (synth_hash(bits + i) & 1) {
+								int gx = x + 4 + g * 6 + i % 5, gy = ty + 1 + i / 5;
+								memcpy(pixels + ((size_t)gy * w + gx) * channels, text, 3);
+							}
+						}
+					}
+				}
+			}
+			x += pw + 8;
+		}
+		y += ph + 8;
+	}
+
+	if (channels == 4) {
+		for (size_t i = 3; i < (size_t)w * h * 4; i += 4) {
+			pixels[i] = 255;
+		}
+	}
+}
+
+// Smooth gradient between four random corner colors
+static void synth_gradient(unsigned char *pixels, int w, int h, int channels, uint32_t seed) {
+	uint32_t rng = synth_hash(seed) | 1;
+	int corners[4][3];
+	for (int i = 0; i < 4; i++) {
+		for (int c = 0; c < 3; c++) {
+			corners[i][c] = synth_range(&rng, 0, 255);
+		}
+	}
+
+	unsigned char *px = pixels;
+	for (int y = 0; y < h; y++) {
+		int64_t fy = h > 1 ? (int64_t)y * 65536 / (h - 1) : 0;
+		for (int x = 0; x < w; x++, px += channels) {
+			int64_t fx = w > 1 ? (int64_t)x * 65536 / (w - 1) : 0;
+			for (int c = 0; c < 3; c++) {
+				int64_t top = corners[0][c] * (65536 - fx) + corners[1][c] * fx;
+				int64_t bottom = corners[2][c] * (65536 - fx) + corners[3][c] * fx;
+				px[c] = (top * (65536 - fy) + bottom * fy) >> 32;
+			}
+			if (channels == 4) {
+				px[3] = 255;
+			}
+		}
+	}
+}
+
+// Uniform noise in all channels
+static void synth_noise_image(unsigned char *pixels, int w, int h, int channels, uint32_t seed) {
+	uint32_t rng = synth_hash(seed) | 1;
+	size_t size = (size_t)w * h * channels;
+	for (size_t i = 0; i < size; i++) {
+		pixels[i] = synth_rand(&rng) >> 24;
+	}
+}
+
+// Photo-like texture: fractal value noise for the luminance, a coarser noise
+// for the color and some grain
+static void synth_photo(unsigned char *pixels, int w, int h, int channels, uint32_t seed) {
+	uint32_t rng = synth_hash(seed) | 1;
+	unsigned char *px = pixels;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++, px += channels) {
+			int l =
+				synth_noise(seed, x, y, 8) / 2 +
+				synth_noise(seed + 1, x, y, 6) / 4 +
+				synth_noise(seed + 2, x, y, 4) / 8 +
+				synth_noise(seed + 3, x, y, 2) / 8;
+			int cr = synth_noise(seed + 4, x, y, 7) - 128;
+			int cb = synth_noise(seed + 5, x, y, 7) - 128;
+			int grain = (int)(synth_rand(&rng) >> 29) - 4;
+			px[0] = synth_clamp(l + cr / 2 + grain);
+			px[1] = synth_clamp(l - cr / 4 - cb / 4 + grain);
+			px[2] = synth_clamp(l + cb / 2 + grain);
+			if (channels == 4) {
+				px[3] = 255;
+			}
+		}
+	}
+}
+
+// Alpha heavy sprites: shaded discs with anti-aliased edges and translucent
+// shadows, composited over a transparent background
+static void synth_sprites(unsigned char *pixels, int w, int h, int channels, uint32_t seed) {
+	uint32_t rng = synth_hash(seed) | 1;
+	memset(pixels, 0, (size_t)w * h * channels);
+
+	int count = (int)((int64_t)w * h / 2048) + 1;
+	for (int i = 0; i < count; i++) {
+		int r = synth_range(&rng, 4, 32);
+		int cx = synth_range(&rng, 0, w - 1), cy = synth_range(&rng, 0, h - 1);
+		int color[3] = {synth_range(&rng, 0, 255), synth_range(&rng, 0, 255), synth_range(&rng, 0, 255)};
+		int shadow = synth_range(&rng, 0, 3) == 0;
+
+		for (int y = cy - r < 0 ? 0 : cy - r; y <= cy + r && y < h; y++) {
+			for (int x = cx - r < 0 ? 0 : cx - r; x <= cx + r && x < w; x++) {
+				int d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+
+				// r² - d² is about 2r * (r - d): a 1px wide alpha ramp
+				int a = (r * r - d2) * 255 / (2 * r);
+				if (a <= 0) {
+					continue;
+				}
+				a = a > 255 ? 255 : a;
+				int c[3];
+				for (int k = 0; k < 3; k++) {
+					c[k] = shadow ? 0 : color[k] * (r * r * 2 - d2) / (r * r * 2);
+				}
+				if (shadow) {
+					a /= 2;
+				}
+
+				// Straight alpha "over" compositing
+				unsigned char *px = pixels + ((size_t)y * w + x) * channels;
+				int dst_a = channels == 4 ? px[3] : 255;
+				int rest = dst_a * (255 - a) / 255;
+				int out_a = a + rest;
+				for (int k = 0; k < 3; k++) {
+					px[k] = (c[k] * a + px[k] * rest) / out_a;
+				}
+				if (channels == 4) {
+					px[3] = out_a;
+				}
+			}
+		}
+	}
+}
+
+typedef struct {
+	const char *name;
+	int channels;
+	void (*generate)(unsigned char *pixels, int w, int h, int channels, uint32_t seed);
+} synth_kind_t;
+
+synth_kind_t synth_kinds[] = {
+	{"ui", 3, synth_ui},
+	{"gradient", 3, synth_gradient},
+	{"noise", 4, synth_noise_image},
+	{"photo", 3, synth_photo},
+	{"sprites", 4, synth_sprites},
+	// Generated at SYNTH_GIANT_W x SYNTH_GIANT_H instead of the set size
+	{"giant", 3, synth_photo}
+};
+
+#define SYNTH_KINDS (int)(sizeof(synth_kinds) / sizeof(synth_kinds[0]))
+
+// 10240 x 10240, 105 megapixels
+#define SYNTH_GIANT_W 10240
+#define SYNTH_GIANT_H 10240
+
+// Generate the image of kind k. The returned pixels should be free()d.
+void *synth_image(int k, int w, int h, uint32_t seed) {
+	synth_kind_t *kind = &synth_kinds[k];
+	unsigned char *pixels = malloc((size_t)w * h * kind->channels);
+	if (!pixels) {
+		ERROR("Malloc for synthetic %s image of %dx%d failed", kind->name, w, h);
+	}
+	kind->generate(pixels, w, h, kind->channels, synth_hash(seed + k));
+	return pixels;
+}
+
+
+
 // -----------------------------------------------------------------------------
 // benchmark runner
 
@@ -302,12 +662,40 @@ int opt_nodecode = 0;
 int opt_noencode = 0;
 int opt_norecurse = 0;
 int opt_onlytotals = 0;
-
+int opt_reference = 0;
+int opt_lz = 0;
+int opt_threads = 0;
+int opt_stats = 0;
+int opt_pin = -1;
+int opt_synthetic = 0;
+int opt_giant = 0;
+int opt_synth_w = 1920;
+int opt_synth_h = 1080;
+uint32_t opt_seed = 1;
+FILE *opt_json = NULL;
+FILE *opt_csv = NULL;
+const char *opt_baseline = NULL;
+
+
+// The time of every run of one en- or decoder on one image, in ns, and their
+// statistics
+typedef struct {
+	uint64_t *samples;
+	int count;
+	uint64_t min;
+	uint64_t median;
+	uint64_t p90;
+	uint64_t p99;
+	double mean;
+	double stddev;
+} benchmark_samples_t;
 
 typedef struct {
 	uint64_t size;
 	uint64_t encode_time;
 	uint64_t decode_time;
+	benchmark_samples_t encode_samples;
+	benchmark_samples_t decode_samples;
 } benchmark_lib_result_t;
 
 typedef struct {
@@ -319,91 +707,210 @@ typedef struct {
 	benchmark_lib_result_t libpng;
 	benchmark_lib_result_t stbi;
 	benchmark_lib_result_t qoi;
+	benchmark_lib_result_t qoiref;
+	benchmark_lib_result_t qoilz;
+	qoi_stats stats;
 } benchmark_result_t;
 
 
+// Print one row of the table. All values are averaged over the count images
+// of a total as doubles, so that nothing is truncated.
+void benchmark_print_lib(const char *name, benchmark_lib_result_t lib, double count, double px, double raw_size) {
+	double decode_ms = (double)lib.decode_time / count / 1000000.0;
+	double encode_ms = (double)lib.encode_time / count / 1000000.0;
+	double size = (double)lib.size / count;
+	printf(
+		"%-9s%8.1f    %8.1f      %8.2f      %8.2f  %8.0f   %4.1f%%\n",
+		name,
+		decode_ms,
+		encode_ms,
+		(decode_ms > 0 ? px / (decode_ms * 1000.0) : 0),
+		(encode_ms > 0 ? px / (encode_ms * 1000.0) : 0),
+		size/1024,
+		(size/raw_size) * 100.0
+	);
+}
+
+void stats_add(qoi_stats *dst, const qoi_stats *src) {
+	dst->images += src->images;
+	dst->pixels += src->pixels;
+	for (int i = 0; i < QOI_STATS_OPS; i++) {
+		dst->ops[i] += src->ops[i];
+		dst->bytes[i] += src->bytes[i];
+	}
+	for (int i = 0; i < QOI_STATS_RUN_BUCKETS; i++) {
+		dst->runs[i] += src->runs[i];
+	}
+	dst->index_lookups += src->index_lookups;
+	dst->index_hits += src->index_hits;
+	dst->hash_collisions += src->hash_collisions;
+}
+
+// Print the op mix of the qoi encoded image(s)
+void stats_print(const qoi_stats *st) {
+	double ops = 0, bytes = 0;
+	for (int i = 0; i < QOI_STATS_OPS; i++) {
+		ops += st->ops[i];
+		bytes += st->bytes[i];
+	}
+	if (ops == 0) {
+		return;
+	}
+
+	printf("qoi ops       index      diff      luma       run       rgb      rgba\n");
+	printf("ops %%     ");
+	for (int i = 0; i < QOI_STATS_OPS; i++) {
+		printf("%10.1f", st->ops[i] / ops * 100.0);
+	}
+	printf("\nbytes %%   ");
+	for (int i = 0; i < QOI_STATS_OPS; i++) {
+		printf("%10.1f", st->bytes[i] / bytes * 100.0);
+	}
+	printf(
+		"\nindex hit rate: %.1f%%, hash collisions: %.1f%% of lookups, %.2f bits/px\n",
+		st->index_lookups ? (double)st->index_hits / st->index_lookups * 100.0 : 0,
+		st->index_lookups ? (double)st->hash_collisions / st->index_lookups * 100.0 : 0,
+		st->pixels ? bytes * 8 / st->pixels : 0
+	);
+	printf("run lengths:");
+	for (int i = 0; i < QOI_STATS_RUN_BUCKETS; i++) {
+		if (st->runs[i] == 0) {
+			continue;
+		}
+		if (i == QOI_STATS_RUN_BUCKETS - 1) {
+			printf(" %llu+: %llu", 1ull << i, st->runs[i]);
+		}
+		else if (i == 0) {
+			printf(" 1: %llu", st->runs[i]);
+		}
+		else {
+			printf(" %llu-%llu: %llu", 1ull << i, (2ull << i) - 1, st->runs[i]);
+		}
+	}
+	printf("\n");
+}
+
 void benchmark_print_result(benchmark_result_t res) {
-	res.px /= res.count;
-	res.raw_size /= res.count;
-	res.libpng.encode_time /= res.count;
-	res.libpng.decode_time /= res.count;
-	res.libpng.size /= res.count;
-	res.stbi.encode_time /= res.count;
-	res.stbi.decode_time /= res.count;
-	res.stbi.size /= res.count;
-	res.qoi.encode_time /= res.count;
-	res.qoi.decode_time /= res.count;
-	res.qoi.size /= res.count;
-
-	double px = res.px;
+	double count = res.count;
+	double px = (double)res.px / count;
+	double raw_size = (double)res.raw_size / count;
+
 	printf("        decode ms   encode ms   decode mpps   encode mpps   size kb    rate\n");
 	if (!opt_nopng) {
-		printf(
-			"libpng:  %8.1f    %8.1f      %8.2f      %8.2f  %8ld   %4.1f%%\n", 
-			(double)res.libpng.decode_time/1000000.0, 
-			(double)res.libpng.encode_time/1000000.0, 
-			(res.libpng.decode_time > 0 ? px / ((double)res.libpng.decode_time/1000.0) : 0),
-			(res.libpng.encode_time > 0 ? px / ((double)res.libpng.encode_time/1000.0) : 0),
-			res.libpng.size/1024,
-			((double)res.libpng.size/(double)res.raw_size) * 100.0
-		);
-		printf(
-			"stbi:    %8.1f    %8.1f      %8.2f      %8.2f  %8ld   %4.1f%%\n", 
-			(double)res.stbi.decode_time/1000000.0,
-			(double)res.stbi.encode_time/1000000.0,
-			(res.stbi.decode_time > 0 ? px / ((double)res.stbi.decode_time/1000.0) : 0),
-			(res.stbi.encode_time > 0 ? px / ((double)res.stbi.encode_time/1000.0) : 0),
-			res.stbi.size/1024,
-			((double)res.stbi.size/(double)res.raw_size) * 100.0
-		);
+		benchmark_print_lib("libpng:", res.libpng, count, px, raw_size);
+		benchmark_print_lib("stbi:", res.stbi, count, px, raw_size);
+	}
+	benchmark_print_lib("qoi:", res.qoi, count, px, raw_size);
+	if (opt_lz) {
+		benchmark_print_lib("qoi+lz:", res.qoilz, count, px, raw_size);
+		if (res.qoi.size > 0 && res.qoilz.decode_time > 0) {
+			printf(
+				"qoi+lz size vs qoi: %.1f%%, decode %.0f MB/s of raw pixels\n",
+				(double)res.qoilz.size / (double)res.qoi.size * 100.0,
+				(double)res.raw_size / ((double)res.qoilz.decode_time/1000.0)
+			);
+		}
+	}
+	if (opt_reference) {
+		benchmark_print_lib("qoiref:", res.qoiref, count, px, raw_size);
+		if (res.qoi.decode_time > 0 && res.qoiref.decode_time > 0) {
+			printf(
+				"qoi decode speedup over reference: %.2fx\n",
+				(double)res.qoiref.decode_time / (double)res.qoi.decode_time
+			);
+		}
+		if (res.qoi.encode_time > 0 && res.qoiref.encode_time > 0) {
+			printf(
+				"qoi encode speedup over reference: %.2fx\n",
+				(double)res.qoiref.encode_time / (double)res.qoi.encode_time
+			);
+		}
+	}
+	if (opt_stats) {
+		stats_print(&res.stats);
 	}
-	printf(
-		"qoi:     %8.1f    %8.1f      %8.2f      %8.2f  %8ld   %4.1f%%\n", 
-		(double)res.qoi.decode_time/1000000.0,
-		(double)res.qoi.encode_time/1000000.0,
-		(res.qoi.decode_time > 0 ? px / ((double)res.qoi.decode_time/1000.0) : 0),
-		(res.qoi.encode_time > 0 ? px / ((double)res.qoi.encode_time/1000.0) : 0),
-		res.qoi.size/1024,
-		((double)res.qoi.size/(double)res.raw_size) * 100.0
-	);
 	printf("\n");
 }
 
-// Run __VA_ARGS__ a number of times and measure the time taken. The first
-// run is ignored.
-#define BENCHMARK_FN(NOWARMUP, RUNS, AVG_TIME, ...) \
+int compare_u64(const void *a, const void *b) {
+	uint64_t va = *(const uint64_t *)a;
+	uint64_t vb = *(const uint64_t *)b;
+	return va < vb ? -1 : va > vb;
+}
+
+// Take over the count samples and compute their statistics. Percentiles are
+// taken by nearest rank; the stddev is that of a sample.
+void samples_compute(benchmark_samples_t *s, uint64_t *samples, int count) {
+	uint64_t *sorted = malloc(count * sizeof(uint64_t));
+	if (!sorted) {
+		ERROR("Malloc for %d samples failed", count);
+	}
+	memcpy(sorted, samples, count * sizeof(uint64_t));
+	qsort(sorted, count, sizeof(uint64_t), compare_u64);
+
+	s->samples = samples;
+	s->count = count;
+	s->min = sorted[0];
+	s->median = count % 2
+		? sorted[count / 2]
+		: (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+	s->p90 = sorted[(count * 90 + 99) / 100 - 1];
+	s->p99 = sorted[(count * 99 + 99) / 100 - 1];
+
+	double sum = 0, sq = 0;
+	for (int i = 0; i < count; i++) {
+		sum += samples[i];
+	}
+	s->mean = sum / count;
+	for (int i = 0; i < count; i++) {
+		sq += (samples[i] - s->mean) * (samples[i] - s->mean);
+	}
+	s->stddev = count > 1 ? sqrt(sq / (count - 1)) : 0;
+	free(sorted);
+}
+
+// Run __VA_ARGS__ a number of times and measure the time taken by each run.
+// The first run is ignored. The samples and their mean are stored in the
+// OP_samples and OP_time fields of RESULT.
+#define BENCHMARK_FN(NOWARMUP, RUNS, RESULT, OP, ...) \
 	do { \
-		uint64_t time = 0; \
+		uint64_t *bench_samples = malloc((RUNS) * sizeof(uint64_t)); \
+		if (!bench_samples) { \
+			ERROR("Malloc for %d samples failed", RUNS); \
+		} \
 		for (int i = NOWARMUP; i <= RUNS; i++) { \
 			uint64_t time_start = ns(); \
 			__VA_ARGS__ \
 			uint64_t time_end = ns(); \
 			if (i > 0) { \
-				time += time_end - time_start; \
+				bench_samples[i - 1] = time_end - time_start; \
 			} \
 		} \
-		AVG_TIME = time / RUNS; \
+		samples_compute(&RESULT.OP##_samples, bench_samples, RUNS); \
+		RESULT.OP##_time = RESULT.OP##_samples.mean; \
 	} while (0)
 
 
-benchmark_result_t benchmark_image(const char *path) {
-	int encoded_png_size;
-	int encoded_qoi_size;
-	int w;
-	int h;
-	int channels;
-
-	// Load the encoded PNG, encoded QOI and raw pixels into memory
-	if(!stbi_info(path, &w, &h, &channels)) {
-		ERROR("Error decoding header %s", path);
-	}
-
-	if (channels != 3) {
-		channels = 4;
+// Get the size of synthetic image kind k: opt_synth_w x opt_synth_h, or the
+// giant size. Returns 0 for the giant image without opt_giant.
+int synth_size(int k, int *w, int *h) {
+	if (strcmp(synth_kinds[k].name, "giant") == 0) {
+		*w = SYNTH_GIANT_W;
+		*h = SYNTH_GIANT_H;
+		return opt_giant;
 	}
+	*w = opt_synth_w;
+	*h = opt_synth_h;
+	return 1;
+}
 
-	void *pixels = (void *)stbi_load(path, &w, &h, NULL, channels);
-	void *encoded_png = fload(path, &encoded_png_size);
+// Benchmark the raw pixels of the image at path, taking over pixels and
+// encoded_png. encoded_png may only be NULL with opt_nopng.
+benchmark_result_t benchmark_pixels(
+	const char *path, void *pixels, int w, int h, int channels,
+	void *encoded_png, int encoded_png_size
+) {
+	int encoded_qoi_size;
 	void *encoded_qoi = qoi_encode(pixels, &(qoi_desc){
 			.width = w,
 			.height = h, 
@@ -411,10 +918,15 @@ benchmark_result_t benchmark_image(const char *path) {
 			.colorspace = QOI_SRGB
 		}, &encoded_qoi_size);
 
-	if (!pixels || !encoded_qoi || !encoded_png) {
+	if (!encoded_qoi) {
 		ERROR("Error encoding %s", path);
 	}
 
+	qoi_stats stats = {0};
+	if (opt_stats && !qoi_stats_collect(encoded_qoi, encoded_qoi_size, &stats)) {
+		ERROR("Error collecting op stats for %s", path);
+	}
+
 	// Verify QOI Output
 
 	if (!opt_noverify) {
@@ -424,62 +936,170 @@ benchmark_result_t benchmark_image(const char *path) {
 			ERROR("QOI roundtrip pixel mismatch for %s", path);
 		}
 		free(pixels_qoi);
+
+		size_t encoded_par_size;
+		void *encoded_par = qoi_encode_parallel(pixels, &(qoi_desc){
+				.width = w,
+				.height = h,
+				.channels = channels,
+				.colorspace = QOI_SRGB
+			}, 4, &encoded_par_size);
+		if (
+			!encoded_par ||
+			encoded_par_size != (size_t)encoded_qoi_size ||
+			memcmp(encoded_qoi, encoded_par, encoded_qoi_size) != 0
+		) {
+			ERROR("QOI parallel encoder output mismatch for %s", path);
+		}
+		free(encoded_par);
+
+		// Push pieces that don't line up with the rows
+		membuf_t encoded_stream = {0};
+		qoi_encoder enc;
+		int stream_ok = qoi_encoder_init(&enc, &(qoi_desc){
+				.width = w,
+				.height = h,
+				.channels = channels,
+				.colorspace = QOI_SRGB
+			}, membuf_write, &encoded_stream);
+		for (size_t i = 0, px_count = (size_t)w * h; stream_ok && i < px_count; i += 777) {
+			size_t count = px_count - i < 777 ? px_count - i : 777;
+			stream_ok = qoi_encoder_push(&enc, (unsigned char *)pixels + i * channels, count);
+		}
+		if (
+			!stream_ok || !qoi_encoder_finish(&enc) ||
+			encoded_stream.size != (size_t)encoded_qoi_size ||
+			memcmp(encoded_qoi, encoded_stream.data, encoded_qoi_size) != 0
+		) {
+			ERROR("QOI streaming encoder output mismatch for %s", path);
+		}
+		free(encoded_stream.data);
+
+		if (opt_reference) {
+			int encoded_ref_size;
+			void *encoded_ref = qoi_encode_reference(pixels, &(qoi_desc){
+					.width = w,
+					.height = h, 
+					.channels = channels,
+					.colorspace = QOI_SRGB
+				}, &encoded_ref_size);
+			if (
+				encoded_ref_size != encoded_qoi_size ||
+				memcmp(encoded_qoi, encoded_ref, encoded_qoi_size) != 0
+			) {
+				ERROR("QOI reference encoder output mismatch for %s", path);
+			}
+			free(encoded_ref);
+
+			void *pixels_ref = qoi_decode_reference(encoded_qoi, encoded_qoi_size, &dc, channels);
+			if (memcmp(pixels, pixels_ref, w * h * channels) != 0) {
+				ERROR("QOI reference decoder pixel mismatch for %s", path);
+			}
+			free(pixels_ref);
+		}
+
+		if (opt_lz) {
+			size_t packed_size;
+			void *packed = qoi_lz_pack(encoded_qoi, encoded_qoi_size, 0, 1, &packed_size);
+			void *pixels_lz = packed ? qoi_lz_decode(packed, packed_size, &dc, channels, 1) : NULL;
+			if (!pixels_lz || memcmp(pixels, pixels_lz, w * h * channels) != 0) {
+				ERROR("QOI+LZ roundtrip pixel mismatch for %s", path);
+			}
+			free(pixels_lz);
+			free(packed);
+		}
+
+		// qoi_seq_encoder_finish() must be safe to call after a failed init
+		membuf_t seq_out = {0};
+		qoi_seq_encoder seq;
+		if (
+			qoi_seq_encoder_init(&seq, &(qoi_desc){
+				.width = 0,
+				.height = h,
+				.channels = channels,
+				.colorspace = QOI_SRGB
+			}, 0, 0, membuf_write, &seq_out) ||
+			qoi_seq_encoder_finish(&seq)
+		) {
+			ERROR("QOI sequence encoder accepted an empty frame for %s", path);
+		}
+		free(seq_out.data);
 	}
 
 
 
 	benchmark_result_t res = {0};
 	res.count = 1;
-	res.raw_size = w * h * channels;
-	res.px = w * h;
+	res.raw_size = (uint64_t)w * h * channels;
+	res.px = (uint64_t)w * h;
 	res.w = w;
 	res.h = h;
+	res.stats = stats;
 
 
 	// Decoding
 
 	if (!opt_nodecode) {
 		if (!opt_nopng) {
-			BENCHMARK_FN(opt_nowarmup, opt_runs, res.libpng.decode_time, {
+			BENCHMARK_FN(opt_nowarmup, opt_runs, res.libpng, decode, {
 				int dec_w, dec_h;
 				void *dec_p = libpng_decode(encoded_png, encoded_png_size, &dec_w, &dec_h);
 				free(dec_p);
 			});
 
-			BENCHMARK_FN(opt_nowarmup, opt_runs, res.stbi.decode_time, {
+			BENCHMARK_FN(opt_nowarmup, opt_runs, res.stbi, decode, {
 				int dec_w, dec_h, dec_channels;
 				void *dec_p = stbi_load_from_memory(encoded_png, encoded_png_size, &dec_w, &dec_h, &dec_channels, 4);
 				free(dec_p);
 			});
 		}
 
-		BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoi.decode_time, {
+		BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoi, decode, {
 			qoi_desc desc;
 			void *dec_p = qoi_decode(encoded_qoi, encoded_qoi_size, &desc, 4);
 			free(dec_p);
 		});
+
+		if (opt_lz) {
+			size_t packed_size = 0;
+			void *packed = qoi_lz_pack(encoded_qoi, encoded_qoi_size, 0, 1, &packed_size);
+			BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoilz, decode, {
+				qoi_desc desc;
+				void *dec_p = qoi_lz_decode(packed, packed_size, &desc, 4, 1);
+				free(dec_p);
+			});
+			free(packed);
+		}
+
+		if (opt_reference) {
+			BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoiref, decode, {
+				qoi_desc desc;
+				void *dec_p = qoi_decode_reference(encoded_qoi, encoded_qoi_size, &desc, 4);
+				free(dec_p);
+			});
+		}
 	}
 
 
 	// Encoding
 	if (!opt_noencode) {
 		if (!opt_nopng) {
-			BENCHMARK_FN(opt_nowarmup, opt_runs, res.libpng.encode_time, {
-				int enc_size;
+			BENCHMARK_FN(opt_nowarmup, opt_runs, res.libpng, encode, {
+				int enc_size = 0;
 				void *enc_p = libpng_encode(pixels, w, h, channels, &enc_size);
 				res.libpng.size = enc_size;
 				free(enc_p);
 			});
 
-			BENCHMARK_FN(opt_nowarmup, opt_runs, res.stbi.encode_time, {
+			BENCHMARK_FN(opt_nowarmup, opt_runs, res.stbi, encode, {
 				int enc_size = 0;
 				stbi_write_png_to_func(stbi_write_callback, &enc_size, w, h, channels, pixels, 0);
 				res.stbi.size = enc_size;
 			});
 		}
 
-		BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoi.encode_time, {
-			int enc_size;
+		BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoi, encode, {
+			int enc_size = 0;
 			void *enc_p = qoi_encode(pixels, &(qoi_desc){
 				.width = w,
 				.height = h, 
@@ -489,6 +1109,34 @@ benchmark_result_t benchmark_image(const char *path) {
 			res.qoi.size = enc_size;
 			free(enc_p);
 		});
+
+		if (opt_lz) {
+			BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoilz, encode, {
+				size_t enc_size = 0;
+				void *enc_p = qoi_lz_encode(pixels, &(qoi_desc){
+					.width = w,
+					.height = h, 
+					.channels = channels,
+					.colorspace = QOI_SRGB
+				}, 1, &enc_size);
+				res.qoilz.size = enc_size;
+				free(enc_p);
+			});
+		}
+
+		if (opt_reference) {
+			BENCHMARK_FN(opt_nowarmup, opt_runs, res.qoiref, encode, {
+				int enc_size = 0;
+				void *enc_p = qoi_encode_reference(pixels, &(qoi_desc){
+					.width = w,
+					.height = h, 
+					.channels = channels,
+					.colorspace = QOI_SRGB
+				}, &enc_size);
+				res.qoiref.size = enc_size;
+				free(enc_p);
+			});
+		}
 	}
 
 	free(pixels);
@@ -498,6 +1146,643 @@ benchmark_result_t benchmark_image(const char *path) {
 	return res;
 }
 
+benchmark_result_t benchmark_image(const char *path) {
+	int encoded_png_size;
+	int w;
+	int h;
+	int channels;
+
+	// Load the encoded PNG and raw pixels into memory
+	if(!stbi_info(path, &w, &h, &channels)) {
+		ERROR("Error decoding header %s", path);
+	}
+
+	if (channels != 3) {
+		channels = 4;
+	}
+
+	void *pixels = (void *)stbi_load(path, &w, &h, NULL, channels);
+	void *encoded_png = fload(path, &encoded_png_size);
+
+	if (!pixels || !encoded_png) {
+		ERROR("Error encoding %s", path);
+	}
+
+	return benchmark_pixels(path, pixels, w, h, channels, encoded_png, encoded_png_size);
+}
+
+// -----------------------------------------------------------------------------
+// Per-run samples: distribution table, JSON/CSV output and the comparison with
+// a baseline CSV written by an earlier run
+
+typedef struct {
+	const char *name;
+	benchmark_lib_result_t *lib;
+} benchmark_lib_t;
+
+// Fill libs with the libs that were run, in table order. The names are the ones
+// used in the JSON and CSV output.
+int benchmark_libs(benchmark_result_t *res, benchmark_lib_t libs[5]) {
+	int count = 0;
+	if (!opt_nopng) {
+		libs[count++] = (benchmark_lib_t){"libpng", &res->libpng};
+		libs[count++] = (benchmark_lib_t){"stbi", &res->stbi};
+	}
+	libs[count++] = (benchmark_lib_t){"qoi", &res->qoi};
+	if (opt_lz) {
+		libs[count++] = (benchmark_lib_t){"qoi+lz", &res->qoilz};
+	}
+	if (opt_reference) {
+		libs[count++] = (benchmark_lib_t){"qoiref", &res->qoiref};
+	}
+	return count;
+}
+
+void benchmark_free_samples(benchmark_result_t *res) {
+	benchmark_lib_t libs[5];
+	int count = benchmark_libs(res, libs);
+	for (int i = 0; i < count; i++) {
+		free(libs[i].lib->decode_samples.samples);
+		free(libs[i].lib->encode_samples.samples);
+	}
+}
+
+void benchmark_print_samples(benchmark_result_t *res) {
+	benchmark_lib_t libs[5];
+	int count = benchmark_libs(res, libs);
+
+	printf("                 min ms   median ms      p90 ms      p99 ms   stddev ms\n");
+	for (int i = 0; i < count; i++) {
+		for (int op = 0; op < 2; op++) {
+			benchmark_samples_t *s = op
+				? &libs[i].lib->encode_samples
+				: &libs[i].lib->decode_samples;
+			if (s->count == 0) {
+				continue;
+			}
+			printf(
+				"%-7s%s  %10.3f  %10.3f  %10.3f  %10.3f  %10.3f\n",
+				libs[i].name, op ? "encode" : "decode",
+				s->min / 1000000.0, s->median / 1000000.0,
+				s->p90 / 1000000.0, s->p99 / 1000000.0,
+				s->stddev / 1000000.0
+			);
+		}
+	}
+	printf("\n");
+}
+
+void benchmark_write_csv_head(void) {
+	fprintf(
+		opt_csv,
+		"image,width,height,lib,op,size,runs,"
+		"min_ns,median_ns,p90_ns,p99_ns,mean_ns,stddev_ns,samples_ns\n"
+	);
+}
+
+// Write one record per lib and op of the image to the JSON and CSV files.
+// Image paths are quoted in the CSV, with quotes doubled.
+void benchmark_write_records(const char *path, benchmark_result_t *res) {
+	static int json_records = 0;
+	benchmark_lib_t libs[5];
+	int count = benchmark_libs(res, libs);
+
+	for (int i = 0; i < count; i++) {
+		for (int op = 0; op < 2; op++) {
+			benchmark_samples_t *s = op
+				? &libs[i].lib->encode_samples
+				: &libs[i].lib->decode_samples;
+			if (s->count == 0) {
+				continue;
+			}
+			const char *op_name = op ? "encode" : "decode";
+
+			if (opt_csv) {
+				fputc('"', opt_csv);
+				for (const char *c = path; *c; c++) {
+					if (*c == '"') {
+						fputc('"', opt_csv);
+					}
+					fputc(*c, opt_csv);
+				}
+				fprintf(
+					opt_csv,
+					"\",%d,%d,%s,%s,%llu,%d,%llu,%llu,%llu,%llu,%.0f,%.0f,",
+					res->w, res->h, libs[i].name, op_name,
+					(unsigned long long)libs[i].lib->size, s->count,
+					(unsigned long long)s->min, (unsigned long long)s->median,
+					(unsigned long long)s->p90, (unsigned long long)s->p99,
+					s->mean, s->stddev
+				);
+				for (int j = 0; j < s->count; j++) {
+					fprintf(opt_csv, "%s%llu", j ? ";" : "", (unsigned long long)s->samples[j]);
+				}
+				fputc('\n', opt_csv);
+			}
+
+			if (opt_json) {
+				fprintf(opt_json, "%s\n  {\"image\": \"", json_records++ ? "," : "");
+				for (const char *c = path; *c; c++) {
+					if (*c == '"' || *c == '\\') {
+						fputc('\\', opt_json);
+					}
+					fputc(*c, opt_json);
+				}
+				fprintf(
+					opt_json,
+					"\", \"width\": %d, \"height\": %d, \"lib\": \"%s\", \"op\": \"%s\", "
+					"\"size\": %llu, \"runs\": %d, \"min_ns\": %llu, \"median_ns\": %llu, "
+					"\"p90_ns\": %llu, \"p99_ns\": %llu, \"mean_ns\": %.0f, \"stddev_ns\": %.0f, "
+					"\"samples_ns\": [",
+					res->w, res->h, libs[i].name, op_name,
+					(unsigned long long)libs[i].lib->size, s->count,
+					(unsigned long long)s->min, (unsigned long long)s->median,
+					(unsigned long long)s->p90, (unsigned long long)s->p99,
+					s->mean, s->stddev
+				);
+				for (int j = 0; j < s->count; j++) {
+					fprintf(opt_json, "%s%llu", j ? ", " : "", (unsigned long long)s->samples[j]);
+				}
+				fprintf(opt_json, "]}");
+			}
+		}
+	}
+}
+
+typedef struct {
+	char *image;
+	char lib[16];
+	char op[8];
+	uint64_t *samples;
+	int count;
+} baseline_record_t;
+
+baseline_record_t *baseline_records = NULL;
+int baseline_count = 0;
+int baseline_compared = 0;
+int baseline_regressions = 0;
+
+// Load the records of a CSV written with --csv
+void baseline_load(const char *path) {
+	int size;
+	char *data = fload(path, &size);
+	char *end = data + size;
+	int capacity = 0;
+
+	// Skip the head line
+	char *p = memchr(data, '\n', size);
+	p = p ? p + 1 : end;
+
+	while (p < end) {
+		char *line_end = memchr(p, '\n', end - p);
+		if (!line_end) {
+			line_end = end;
+		}
+		*line_end = '\0';
+		if (*p != '"') {
+			ERROR("Malformed baseline record in %s: %s", path, p);
+		}
+
+		// Unquote the image path in place
+		char *image = ++p, *w = p;
+		while (p < line_end && !(p[0] == '"' && p[1] != '"')) {
+			if (p[0] == '"') {
+				p++;
+			}
+			*w++ = *p++;
+		}
+		if (p >= line_end) {
+			ERROR("Malformed baseline record in %s", path);
+		}
+
+		baseline_record_t rec = {0};
+		int samples_pos = 0;
+		if (
+			sscanf(p, "\",%*d,%*d,%15[^,],%7[^,],%*u,%d,%*u,%*u,%*u,%*u,%*f,%*f,%n",
+				rec.lib, rec.op, &rec.count, &samples_pos) != 3 ||
+			samples_pos == 0 || rec.count <= 0
+		) {
+			ERROR("Malformed baseline record in %s", path);
+		}
+		// Terminate the path only now; it may end right on the closing quote
+		*w = '\0';
+		rec.image = image;
+		rec.samples = malloc(rec.count * sizeof(uint64_t));
+		if (!rec.samples) {
+			ERROR("Malloc for %d samples failed", rec.count);
+		}
+		char *sp = p + samples_pos;
+		for (int i = 0; i < rec.count; i++) {
+			rec.samples[i] = strtoull(sp, &sp, 10);
+			if (*sp == ';') {
+				sp++;
+			}
+		}
+
+		if (baseline_count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			baseline_records = realloc(baseline_records, capacity * sizeof(baseline_record_t));
+			if (!baseline_records) {
+				ERROR("Malloc for %d baseline records failed", capacity);
+			}
+		}
+		baseline_records[baseline_count++] = rec;
+		p = line_end + 1;
+	}
+
+	// The image paths point into data, which is kept for the whole run
+}
+
+// One-sided Mann-Whitney U test on the normal approximation. Returns the z
+// score of b being slower than a; ties get the average rank.
+double mann_whitney_z(const uint64_t *a, int na, const uint64_t *b, int nb) {
+	double rank_sum = 0;
+	for (int i = 0; i < nb; i++) {
+		int less = 0, equal = 0;
+		for (int j = 0; j < na; j++) {
+			less += a[j] < b[i];
+			equal += a[j] == b[i];
+		}
+		for (int j = 0; j < nb; j++) {
+			less += b[j] < b[i];
+			equal += b[j] == b[i];
+		}
+		rank_sum += less + (equal + 1) / 2.0;
+	}
+	double u = rank_sum - nb * (nb + 1) / 2.0;
+	double mean = na * nb / 2.0;
+	double sd = sqrt(na * nb * (na + nb + 1) / 12.0);
+	return sd > 0 ? (u - mean) / sd : 0;
+}
+
+// Compare every lib and op of the image with the baseline. A regression is
+// a change that is significant at p < 0.01 and at least 2% slower in the
+// median, so that a handful of runs can't flag one on noise alone.
+void baseline_compare(const char *path, benchmark_result_t *res) {
+	benchmark_lib_t libs[5];
+	int count = benchmark_libs(res, libs);
+
+	for (int i = 0; i < count; i++) {
+		for (int op = 0; op < 2; op++) {
+			benchmark_samples_t *s = op
+				? &libs[i].lib->encode_samples
+				: &libs[i].lib->decode_samples;
+			const char *op_name = op ? "encode" : "decode";
+			if (s->count == 0) {
+				continue;
+			}
+
+			for (int j = 0; j < baseline_count; j++) {
+				baseline_record_t *rec = &baseline_records[j];
+				if (
+					strcmp(rec->image, path) != 0 ||
+					strcmp(rec->lib, libs[i].name) != 0 ||
+					strcmp(rec->op, op_name) != 0
+				) {
+					continue;
+				}
+
+				benchmark_samples_t base;
+				uint64_t *base_samples = malloc(rec->count * sizeof(uint64_t));
+				if (!base_samples) {
+					ERROR("Malloc for %d samples failed", rec->count);
+				}
+				memcpy(base_samples, rec->samples, rec->count * sizeof(uint64_t));
+				samples_compute(&base, base_samples, rec->count);
+
+				double z = mann_whitney_z(rec->samples, rec->count, s->samples, s->count);
+				double change = (double)s->median / (double)base.median - 1.0;
+				baseline_compared++;
+				if (z > 2.33 && change >= 0.02) {
+					baseline_regressions++;
+					printf(
+						"## REGRESSION %s %s %s: median %.3f ms -> %.3f ms (%+.1f%%, z=%.2f)\n",
+						path, libs[i].name, op_name,
+						base.median / 1000000.0, s->median / 1000000.0,
+						change * 100.0, z
+					);
+				}
+				free(base_samples);
+				break;
+			}
+		}
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// CPU pinning
+
+// Pin thread to cpu, wrapped around the number of online cpus
+void pin_thread(pthread_t thread, int cpu) {
+	#if defined(__linux)
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu % (ncpu > 0 ? ncpu : 1), &set);
+		if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0) {
+			ERROR("Couldn't pin thread to cpu %d", cpu);
+		}
+	#else
+		(void)thread;
+		ERROR("Pinning to cpu %d is not supported on this platform", cpu);
+	#endif
+}
+
+// -----------------------------------------------------------------------------
+// throughput scaling: run the whole corpus on 1 to opt_threads worker threads
+// at once. Each worker en-/decodes whole images on its own, as a server would,
+// so the numbers include memory bandwidth, malloc and shared cache contention.
+
+typedef struct {
+	void *pixels;
+	void *encoded;
+	int encoded_size;
+	int w;
+	int h;
+	int channels;
+} throughput_image_t;
+
+typedef struct {
+	throughput_image_t *images;
+	int count;
+	int capacity;
+	uint64_t px;
+	uint64_t raw_size;
+} throughput_corpus_t;
+
+typedef struct {
+	throughput_corpus_t *corpus;
+	int jobs;
+	int encode;
+	int next;
+} throughput_job_t;
+
+// Add the image to the corpus, taking over pixels
+void throughput_add_image(throughput_corpus_t *corpus, const char *name, void *pixels, int w, int h, int channels) {
+	if (corpus->count == corpus->capacity) {
+		corpus->capacity = corpus->capacity ? corpus->capacity * 2 : 64;
+		corpus->images = realloc(corpus->images, corpus->capacity * sizeof(throughput_image_t));
+		if (!corpus->images) {
+			ERROR("Malloc for %d images failed", corpus->capacity);
+		}
+	}
+
+	throughput_image_t *img = &corpus->images[corpus->count++];
+	img->w = w;
+	img->h = h;
+	img->channels = channels;
+	img->pixels = pixels;
+	img->encoded = qoi_encode(img->pixels, &(qoi_desc){
+			.width = w,
+			.height = h,
+			.channels = channels,
+			.colorspace = QOI_SRGB
+		}, &img->encoded_size);
+	if (!img->encoded) {
+		ERROR("Error encoding %s", name);
+	}
+
+	corpus->px += (uint64_t)w * h;
+	corpus->raw_size += (uint64_t)w * h * channels;
+}
+
+void throughput_load_directory(const char *path, throughput_corpus_t *corpus) {
+	DIR *dir = opendir(path);
+	if (!dir) {
+		ERROR("Couldn't open directory %s", path);
+	}
+
+	struct dirent *file;
+	while ((file = readdir(dir)) != NULL) {
+		char file_path[1024];
+		snprintf(file_path, 1024, "%s/%s", path, file->d_name);
+
+		if (file->d_type & DT_DIR) {
+			if (
+				!opt_norecurse &&
+				strcmp(file->d_name, ".") != 0 &&
+				strcmp(file->d_name, "..") != 0
+			) {
+				throughput_load_directory(file_path, corpus);
+			}
+			continue;
+		}
+		if (strcmp(file->d_name + strlen(file->d_name) - 4, ".png") != 0) {
+			continue;
+		}
+
+		int w, h, channels;
+		if (!stbi_info(file_path, &w, &h, &channels)) {
+			ERROR("Error decoding header %s", file_path);
+		}
+		if (channels != 3) {
+			channels = 4;
+		}
+
+		void *pixels = stbi_load(file_path, &w, &h, NULL, channels);
+		if (!pixels) {
+			ERROR("Error decoding %s", file_path);
+		}
+		throughput_add_image(corpus, file_path, pixels, w, h, channels);
+	}
+	closedir(dir);
+}
+
+void throughput_load_synthetic(throughput_corpus_t *corpus) {
+	for (int k = 0; k < SYNTH_KINDS; k++) {
+		int w, h;
+		if (!synth_size(k, &w, &h)) {
+			continue;
+		}
+		void *pixels = synth_image(k, w, h, opt_seed);
+		throughput_add_image(corpus, synth_kinds[k].name, pixels, w, h, synth_kinds[k].channels);
+	}
+}
+
+void *throughput_worker(void *user) {
+	throughput_job_t *job = (throughput_job_t *)user;
+	int i;
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->jobs) {
+		throughput_image_t *img = &job->corpus->images[i % job->corpus->count];
+		if (job->encode) {
+			int enc_size = 0;
+			void *enc_p = qoi_encode(img->pixels, &(qoi_desc){
+				.width = img->w,
+				.height = img->h,
+				.channels = img->channels,
+				.colorspace = QOI_SRGB
+			}, &enc_size);
+			free(enc_p);
+		}
+		else {
+			qoi_desc desc;
+			void *dec_p = qoi_decode(img->encoded, img->encoded_size, &desc, 4);
+			free(dec_p);
+		}
+	}
+	return NULL;
+}
+
+// Run every image opt_runs times on nthreads threads and return the wall
+// clock time
+uint64_t throughput_run(throughput_corpus_t *corpus, int nthreads, int encode) {
+	throughput_job_t job = {
+		.corpus = corpus,
+		.jobs = corpus->count * opt_runs,
+		.encode = encode,
+		.next = 0
+	};
+	pthread_t threads[nthreads];
+
+	uint64_t time_start = ns();
+	for (int i = 1; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, throughput_worker, &job) != 0) {
+			ERROR("Couldn't create thread %d", i);
+		}
+		if (opt_pin >= 0) {
+			pin_thread(threads[i], opt_pin + i);
+		}
+	}
+	throughput_worker(&job);
+	for (int i = 1; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	return ns() - time_start;
+}
+
+void benchmark_throughput(const char *path) {
+	throughput_corpus_t corpus = {0};
+	if (opt_synthetic) {
+		throughput_load_synthetic(&corpus);
+	}
+	else {
+		throughput_load_directory(path, &corpus);
+	}
+	if (corpus.count == 0) {
+		printf("No images found in %s\n", path);
+		return;
+	}
+
+	printf(
+		"## Throughput scaling for %s -- %d images, %d runs\n\n",
+		path, corpus.count, opt_runs
+	);
+	printf("threads   decode mpps   decode MB/s   encode mpps   encode MB/s   decode scaling   encode scaling\n");
+
+	if (!opt_nowarmup) {
+		if (!opt_nodecode) {
+			throughput_run(&corpus, opt_threads, 0);
+		}
+		if (!opt_noencode) {
+			throughput_run(&corpus, opt_threads, 1);
+		}
+	}
+
+	// 1, 2, 4 ... threads up to and including opt_threads
+	double decode_base = 0, encode_base = 0;
+	for (int nthreads = 1; ; nthreads *= 2) {
+		if (nthreads > opt_threads) {
+			nthreads = opt_threads;
+		}
+		double decode_mpps = 0, decode_mbps = 0, encode_mpps = 0, encode_mbps = 0;
+		double px = (double)corpus.px * opt_runs;
+
+		if (!opt_nodecode) {
+			double us = throughput_run(&corpus, nthreads, 0) / 1000.0;
+			decode_mpps = px / us;
+			// Images are decoded to RGBA, as in benchmark_image()
+			decode_mbps = (double)corpus.px * 4 * opt_runs / us;
+		}
+		if (!opt_noencode) {
+			double us = throughput_run(&corpus, nthreads, 1) / 1000.0;
+			encode_mpps = px / us;
+			encode_mbps = (double)corpus.raw_size * opt_runs / us;
+		}
+		if (nthreads == 1) {
+			decode_base = decode_mpps;
+			encode_base = encode_mpps;
+		}
+
+		printf(
+			"%7d      %8.2f      %8.1f      %8.2f      %8.1f           %5.2fx           %5.2fx\n",
+			nthreads, decode_mpps, decode_mbps, encode_mpps, encode_mbps,
+			decode_base > 0 ? decode_mpps / decode_base : 0,
+			encode_base > 0 ? encode_mpps / encode_base : 0
+		);
+
+		if (nthreads == opt_threads) {
+			break;
+		}
+	}
+	printf("\n");
+
+	for (int i = 0; i < corpus.count; i++) {
+		free(corpus.images[i].pixels);
+		free(corpus.images[i].encoded);
+	}
+	free(corpus.images);
+}
+
+void benchmark_add_total(benchmark_result_t *total, const benchmark_result_t *res) {
+	total->count++;
+	total->raw_size += res->raw_size;
+	total->px += res->px;
+	total->libpng.encode_time += res->libpng.encode_time;
+	total->libpng.decode_time += res->libpng.decode_time;
+	total->libpng.size += res->libpng.size;
+	total->stbi.encode_time += res->stbi.encode_time;
+	total->stbi.decode_time += res->stbi.decode_time;
+	total->stbi.size += res->stbi.size;
+	total->qoi.encode_time += res->qoi.encode_time;
+	total->qoi.decode_time += res->qoi.decode_time;
+	total->qoi.size += res->qoi.size;
+	total->qoiref.encode_time += res->qoiref.encode_time;
+	total->qoiref.decode_time += res->qoiref.decode_time;
+	total->qoiref.size += res->qoiref.size;
+	total->qoilz.encode_time += res->qoilz.encode_time;
+	total->qoilz.decode_time += res->qoilz.decode_time;
+	total->qoilz.size += res->qoilz.size;
+	stats_add(&total->stats, &res->stats);
+}
+
+// Print, write and compare the result of one image, then free its samples
+void benchmark_report_image(const char *path, benchmark_result_t *res) {
+	if (!opt_onlytotals) {
+		printf("## %s size: %dx%d\n", path, res->w, res->h);
+		benchmark_print_result(*res);
+		if (opt_runs > 1) {
+			benchmark_print_samples(res);
+		}
+	}
+	benchmark_write_records(path, res);
+	if (opt_baseline) {
+		baseline_compare(path, res);
+	}
+	benchmark_free_samples(res);
+}
+
+void benchmark_synthetic(benchmark_result_t *grand_total) {
+	printf(
+		"## Benchmarking synthetic images -- seed %u, %dx%d, %d runs\n\n",
+		opt_seed, opt_synth_w, opt_synth_h, opt_runs
+	);
+
+	for (int k = 0; k < SYNTH_KINDS; k++) {
+		int w, h;
+		if (!synth_size(k, &w, &h)) {
+			continue;
+		}
+
+		char name[64];
+		snprintf(name, 64, "synthetic/%s", synth_kinds[k].name);
+		void *pixels = synth_image(k, w, h, opt_seed);
+		benchmark_result_t res = benchmark_pixels(name, pixels, w, h, synth_kinds[k].channels, NULL, 0);
+		benchmark_report_image(name, &res);
+		benchmark_add_total(grand_total, &res);
+	}
+}
+
 void benchmark_directory(const char *path, benchmark_result_t *grand_total) {
 	DIR *dir = opendir(path);
 	if (!dir) {
@@ -538,39 +1823,11 @@ void benchmark_directory(const char *path, benchmark_result_t *grand_total) {
 		sprintf(file_path, "%s/%s", path, file->d_name);
 		
 		benchmark_result_t res = benchmark_image(file_path);
-
-		if (!opt_onlytotals) {
-			printf("## %s size: %dx%d\n", file_path, res.w, res.h);
-			benchmark_print_result(res);
-		}
-
+		benchmark_report_image(file_path, &res);
 		free(file_path);
-		
-		dir_total.count++;
-		dir_total.raw_size += res.raw_size;
-		dir_total.px += res.px;
-		dir_total.libpng.encode_time += res.libpng.encode_time;
-		dir_total.libpng.decode_time += res.libpng.decode_time;
-		dir_total.libpng.size += res.libpng.size;
-		dir_total.stbi.encode_time += res.stbi.encode_time;
-		dir_total.stbi.decode_time += res.stbi.decode_time;
-		dir_total.stbi.size += res.stbi.size;
-		dir_total.qoi.encode_time += res.qoi.encode_time;
-		dir_total.qoi.decode_time += res.qoi.decode_time;
-		dir_total.qoi.size += res.qoi.size;
-
-		grand_total->count++;
-		grand_total->raw_size += res.raw_size;
-		grand_total->px += res.px;
-		grand_total->libpng.encode_time += res.libpng.encode_time;
-		grand_total->libpng.decode_time += res.libpng.decode_time;
-		grand_total->libpng.size += res.libpng.size;
-		grand_total->stbi.encode_time += res.stbi.encode_time;
-		grand_total->stbi.decode_time += res.stbi.decode_time;
-		grand_total->stbi.size += res.stbi.size;
-		grand_total->qoi.encode_time += res.qoi.encode_time;
-		grand_total->qoi.decode_time += res.qoi.decode_time;
-		grand_total->qoi.size += res.qoi.size;
+
+		benchmark_add_total(&dir_total, &res);
+		benchmark_add_total(grand_total, &res);
 	}
 	closedir(dir);
 
@@ -582,7 +1839,7 @@ void benchmark_directory(const char *path, benchmark_result_t *grand_total) {
 
 int main(int argc, char **argv) {
 	if (argc < 3) {
-		printf("Usage: qoibench <iterations> <directory> [options]\n");
+		printf("Usage: qoibench <iterations> <directory|synthetic> [options]\n");
 		printf("Options:\n");
 		printf("    --nowarmup ... don't perform a warmup run\n");
 		printf("    --nopng ...... don't run png encode/decode\n");
@@ -591,12 +1848,33 @@ int main(int argc, char **argv) {
 		printf("    --nodecode ... don't run decoders\n");
 		printf("    --norecurse .. don't descend into directories\n");
 		printf("    --onlytotals . don't print individual image results\n");
+		printf("    --reference .. also run the reference qoi loops and report the speedup\n");
+		printf("    --lz ......... also run qoi with the LZ back-end and report the size\n");
+		printf("    --stats ...... report the qoi op mix, run lengths and index hit rate\n");
+		printf("    --size WxH ... size of the synthetic images (default 1920x1080)\n");
+		printf("    --seed N ..... seed of the synthetic images (default 1)\n");
+		printf("    --giant ...... also run a synthetic image of %dx%d pixels\n", SYNTH_GIANT_W, SYNTH_GIANT_H);
+		printf("    --threads N .. run the corpus on 1 to N threads at once and report the\n");
+		printf("                   aggregate throughput for each thread count; can't be\n");
+		printf("                   combined with --json, --csv, --baseline, --stats, --lz\n");
+		printf("                   or --reference\n");
+		printf("    --pin CPU .... pin the benchmark to CPU; with --threads, thread i to CPU+i\n");
+		printf("    --json FILE .. write every sample of every image to FILE as JSON\n");
+		printf("    --csv FILE ... write every sample of every image to FILE as CSV\n");
+		printf("    --baseline FILE  compare with the samples of an earlier --csv FILE and\n");
+		printf("                   report significant regressions; exits with 2 if any\n");
 		printf("Examples\n");
 		printf("    qoibench 10 images/textures/\n");
 		printf("    qoibench 1 images/textures/ --nopng --nowarmup\n");
+		printf("    qoibench 5 images/ --threads 16\n");
+		printf("    qoibench 10 synthetic --size 3840x2160 --seed 7\n");
+		printf("    qoibench 20 images/ --pin 2 --csv base.csv\n");
+		printf("    qoibench 20 images/ --pin 2 --baseline base.csv\n");
 		exit(1);
 	}
 
+	const char *json_path = NULL;
+	const char *csv_path = NULL;
 	for (int i = 3; i < argc; i++) {
 		if (strcmp(argv[i], "--nowarmup") == 0) { opt_nowarmup = 1; }
 		else if (strcmp(argv[i], "--nopng") == 0) { opt_nopng = 1; }
@@ -605,6 +1883,44 @@ int main(int argc, char **argv) {
 		else if (strcmp(argv[i], "--nodecode") == 0) { opt_nodecode = 1; }
 		else if (strcmp(argv[i], "--norecurse") == 0) { opt_norecurse = 1; }
 		else if (strcmp(argv[i], "--onlytotals") == 0) { opt_onlytotals = 1; }
+		else if (strcmp(argv[i], "--reference") == 0) { opt_reference = 1; }
+		else if (strcmp(argv[i], "--lz") == 0) { opt_lz = 1; }
+		else if (strcmp(argv[i], "--stats") == 0) { opt_stats = 1; }
+		else if (strcmp(argv[i], "--giant") == 0) { opt_giant = 1; }
+		else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+			// Keep the worst case qoi size of an RGBA image within an int
+			if (
+				sscanf(argv[++i], "%dx%d", &opt_synth_w, &opt_synth_h) != 2 ||
+				opt_synth_w <= 0 || opt_synth_h <= 0 ||
+				(int64_t)opt_synth_w * opt_synth_h > 256 * 1024 * 1024
+			) {
+				ERROR("Invalid size %s", argv[i]);
+			}
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			opt_seed = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			opt_threads = atoi(argv[++i]);
+			if (opt_threads <= 0) {
+				ERROR("Invalid number of threads %s", argv[i]);
+			}
+		}
+		else if (strcmp(argv[i], "--pin") == 0 && i + 1 < argc) {
+			opt_pin = atoi(argv[++i]);
+			if (opt_pin < 0) {
+				ERROR("Invalid cpu %s", argv[i]);
+			}
+		}
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+			json_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+			csv_path = argv[++i];
+		}
+		else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+			opt_baseline = argv[++i];
+		}
 		else { ERROR("Unknown option %s", argv[i]); }
 	}
 
@@ -613,8 +1929,67 @@ int main(int argc, char **argv) {
 		ERROR("Invalid number of runs %d", opt_runs);
 	}
 
+	// The throughput mode only reports the aggregate rate per thread count
+	if (
+		opt_threads > 0 &&
+		(json_path || csv_path || opt_baseline || opt_stats || opt_lz || opt_reference)
+	) {
+		ERROR("--threads can't be combined with --json, --csv, --baseline, --stats, --lz or --reference");
+	}
+
+	if (json_path) {
+		opt_json = fopen(json_path, "w");
+		if (!opt_json) {
+			ERROR("Can't open %s", json_path);
+		}
+	}
+	if (csv_path) {
+		opt_csv = fopen(csv_path, "w");
+		if (!opt_csv) {
+			ERROR("Can't open %s", csv_path);
+		}
+	}
+
+	if (opt_pin >= 0) {
+		pin_thread(pthread_self(), opt_pin);
+	}
+
+	// Synthetic images are only benchmarked against qoi; there are no PNGs
+	if (strcmp(argv[2], "synthetic") == 0) {
+		opt_synthetic = 1;
+		opt_nopng = 1;
+	}
+
+	if (opt_threads > 0) {
+		benchmark_throughput(argv[2]);
+		return 0;
+	}
+
+	if (opt_baseline) {
+		baseline_load(opt_baseline);
+	}
+	if (opt_csv) {
+		benchmark_write_csv_head();
+	}
+	if (opt_json) {
+		fprintf(opt_json, "[");
+	}
+
 	benchmark_result_t grand_total = {0};
-	benchmark_directory(argv[2], &grand_total);
+	if (opt_synthetic) {
+		benchmark_synthetic(&grand_total);
+	}
+	else {
+		benchmark_directory(argv[2], &grand_total);
+	}
+
+	if (opt_json) {
+		fprintf(opt_json, "\n]\n");
+		fclose(opt_json);
+	}
+	if (opt_csv) {
+		fclose(opt_csv);
+	}
 
 	if (grand_total.count > 0) {
 		printf("# Grand total for %s\n", argv[2]);
@@ -624,5 +1999,15 @@ int main(int argc, char **argv) {
 		printf("No images found in %s\n", argv[2]);
 	}
 
+	if (opt_baseline) {
+		printf(
+			"# Baseline %s: %d regressions in %d comparisons\n",
+			opt_baseline, baseline_regressions, baseline_compared
+		);
+		if (baseline_regressions > 0) {
+			return 2;
+		}
+	}
+
 	return 0;
 }
@@ -12,11 +12,16 @@ Requires:
 	-"qoi.h" (https://github.com/phoboslab/qoi/blob/master/qoi.h)
 
 Compile with: 
-	gcc qoiconv.c -std=c99 -O3 -o qoiconv
+	gcc qoiconv.c -std=c99 -O3 -pthread -o qoiconv
 
 */
 
 
+#if defined(__linux__)
+	// for fallocate() in qoi_write()
+	#define _GNU_SOURCE
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_ONLY_PNG
 #define STBI_NO_LINEAR
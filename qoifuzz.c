@@ -4,9 +4,14 @@ Copyright (c) 2021, Dominic Szablewski - https://phoboslab.org
 SPDX-License-Identifier: MIT
 
 
-clang fuzzing harness for qoi_decode
+clang fuzzing harness for the decoders of qoi.h
 
-Compile and run with: 
+The first byte of the input selects the decoder: plain and parallel decoding,
+sequences, qoi_probe and qoi_validate, LZ packed images or tiled images. The
+second byte selects the channels to decode into. The rest is passed to the
+decoder.
+
+Compile and run with:
 	clang -fsanitize=address,fuzzer -g -O0 qoifuzz.c && ./a.out
 
 */
@@ -17,16 +22,106 @@ Compile and run with:
 #include <stddef.h>
 #include <stdint.h>
 
-int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
-	int w, h;
-	if (size < 4) {
-		return 0;
-	}
+// Largest pixel buffer allocated for the frames of a sequence
+#define FUZZ_MAX_PIXELS_SIZE (64 * 1024 * 1024)
 
+static void fuzz_decode(const uint8_t *data, size_t size, int channels) {
 	qoi_desc desc;
-	void* decoded = qoi_decode((void*)(data + 4), (int)(size - 4), &desc, *((int *)data));
+	void* decoded = qoi_decode((void*)data, (int)size, &desc, channels);
+	if (decoded != NULL) {
+		free(decoded);
+	}
+
+	// Uses a seek index, if the data ends with one
+	decoded = qoi_decode_parallel((void*)data, size, &desc, channels, 2);
 	if (decoded != NULL) {
 		free(decoded);
 	}
+}
+
+static void fuzz_seq(const uint8_t *data, size_t size, int channels) {
+	qoi_seq seq;
+	if (!qoi_seq_open(&seq, data, size)) {
+		return;
+	}
+
+	unsigned long long pixels_size = (unsigned long long)seq.desc.width *
+		seq.desc.height * (channels ? channels : seq.desc.channels);
+	if (pixels_size == 0 || pixels_size > FUZZ_MAX_PIXELS_SIZE) {
+		return;
+	}
+
+	// Frames after the first build on the previous one, so decode in order
+	void *pixels = malloc((size_t)pixels_size);
+	for (unsigned int i = 0; i < seq.frames && i < 8; i++) {
+		if (!qoi_seq_decode_frame(&seq, i, pixels, channels)) {
+			break;
+		}
+	}
+	free(pixels);
+}
+
+static void fuzz_probe(const uint8_t *data, size_t size) {
+	qoi_info info;
+	qoi_probe(data, size, &info);
+	qoi_validate(data, size, &info);
+}
+
+static void fuzz_lz(const uint8_t *data, size_t size, int channels) {
+	size_t len;
+	void *unpacked = qoi_lz_unpack(data, size, 2, &len);
+	if (unpacked != NULL) {
+		free(unpacked);
+	}
+
+	// One thread streams the blocks, two unpack images with a seek index
+	qoi_desc desc;
+	for (int nthreads = 1; nthreads <= 2; nthreads++) {
+		void *decoded = qoi_lz_decode(data, size, &desc, channels, nthreads);
+		if (decoded != NULL) {
+			free(decoded);
+		}
+	}
+}
+
+static void fuzz_tiled(const uint8_t *data, size_t size, int channels) {
+	qoi_tiled tiled;
+	if (!qoi_tiled_open(&tiled, data, size)) {
+		return;
+	}
+
+	// The bottom right corner covers the smaller edge tiles
+	unsigned int w = tiled.desc.width < 256 ? tiled.desc.width : 256;
+	unsigned int h = tiled.desc.height < 256 ? tiled.desc.height : 256;
+	int bpp = channels ? channels : tiled.desc.channels;
+	if (w == 0 || h == 0) {
+		return;
+	}
+
+	void *pixels = malloc((size_t)w * h * bpp);
+	qoi_tiled_decode_rect(
+		&tiled, tiled.desc.width - w, tiled.desc.height - h, w, h,
+		pixels, (ptrdiff_t)w * bpp, channels, 2
+	);
+	free(pixels);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (size < 2) {
+		return 0;
+	}
+
+	static const int channels_options[] = {0, 3, 4};
+	int channels = channels_options[data[1] % 3];
+	const uint8_t *payload = data + 2;
+	size_t payload_size = size - 2;
+
+	switch (data[0] % 5) {
+		case 0: fuzz_decode(payload, payload_size, channels); break;
+		case 1: fuzz_seq(payload, payload_size, channels); break;
+		case 2: fuzz_probe(payload, payload_size); break;
+		case 3: fuzz_lz(payload, payload_size, channels); break;
+		case 4: fuzz_tiled(payload, payload_size, channels); break;
+	}
 	return 0;
 }